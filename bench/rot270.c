@@ -0,0 +1,119 @@
+/*
+ * font-specimen
+ *
+ * Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* raster_rot270() against a plain per-pixel loop */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../raster.h"
+
+/* bytes rotated per size, so that each size runs for a while */
+#define BENCH_BYTES  (256*1024*1024)
+
+static void naive_rot270(unsigned char *dst, int dst_stride,
+                         const unsigned char *src, int src_stride,
+                         int width, int height)
+{
+  int row, col;
+
+  for (row = 0; row < height; row++)
+    for (col = 0; col < width; col++)
+      dst[col*dst_stride + height - 1 - row] = src[row*src_stride + col];
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+typedef void (*rot_fn_t)(unsigned char *dst, int dst_stride,
+                         const unsigned char *src, int src_stride,
+                         int width, int height);
+
+/* nanoseconds per pixel */
+static double bench(rot_fn_t rot, unsigned char *dst,
+                    const unsigned char *src, int width, int height,
+                    int loops)
+{
+  double start;
+  int l;
+
+  start = now();
+  for (l = 0; l < loops; l++)
+    rot(dst, height, src, width, width, height);
+  return (now() - start)*1e9/((double)loops*width*height);
+}
+
+int main(int argc, char *argv[])
+{
+  /* glyphs of usual sizes, a specimen line, a whole canvas */
+  static const int sizes[][2] = { { 12, 16 }, { 37, 53 }, { 100, 100 },
+                                  { 1000, 120 }, { 2000, 3000 } };
+  unsigned char *src, *dst, *ref;
+  int s, i, width, height, loops;
+  double fast, naive;
+
+  printf("%12s %14s %14s %8s\n", "size", "naive ns/px", "rot270 ns/px",
+         "speedup");
+  for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+  {
+    width = sizes[s][0];
+    height = sizes[s][1];
+    src = (unsigned char *)malloc((size_t)width*height);
+    dst = (unsigned char *)malloc((size_t)width*height);
+    ref = (unsigned char *)malloc((size_t)width*height);
+    if (! src || ! dst || ! ref)
+    {
+      fprintf(stderr, "not enough memory\n");
+      return 1;
+    }
+    for (i = 0; i < width*height; i++)
+      src[i] = (unsigned char)(i*131 + (i >> 8));
+
+    naive_rot270(ref, height, src, width, width, height);
+    raster_rot270(dst, height, src, width, width, height);
+    if (memcmp(ref, dst, (size_t)width*height) != 0)
+    {
+      fprintf(stderr, "%dx%d: raster_rot270() differs\n", width, height);
+      return 1;
+    }
+
+    loops = BENCH_BYTES/(width*height);
+    if (loops < 1)
+      loops = 1;
+    naive = bench(naive_rot270, dst, src, width, height, loops);
+    fast = bench(raster_rot270, dst, src, width, height, loops);
+    printf("%5dx%-6d %14.3f %14.3f %7.1fx\n",
+           width, height, naive, fast, naive/fast);
+
+    free(src);
+    free(dst);
+    free(ref);
+  }
+  return 0;
+}
@@ -1,6 +1,7 @@
 #include "error.h"
 
 #include <stdio.h>
+#include <time.h>
 
 int debug = 0;
 
@@ -14,3 +15,11 @@ void font_specimen_error(const char *string)
   if (debug)
     fprintf(stderr, "%s\n", string);
 }
+
+uint64_t font_specimen_clock(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
@@ -20,5 +20,9 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <stdint.h>
+
 void set_debug(int on);
 void font_specimen_error(const char *string);
+/* monotonic time in nanoseconds, for measuring stages */
+uint64_t font_specimen_clock(void);
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 void fontconfig_version(char* version, int version_max)
 {
@@ -33,6 +34,57 @@ void fontconfig_version(char* version, int version_max)
   return;
 }
 
+/* take a reference to the current configuration, */
+/* initializing fontconfig if needed */
+FcConfig *fontconfig_config_reference(void)
+{
+  FcConfig *config;
+
+  if (!FcInit())
+  {
+    font_specimen_error("fontconfig: can not initialize library");
+    return NULL;
+  }
+
+  config = FcConfigReference(NULL);
+  if (! config)
+    font_specimen_error("fontconfig: can not get current configuration");
+  return config;
+}
+
+void fontconfig_config_destroy(FcConfig *config)
+{
+  FcConfigDestroy(config);
+  return;
+}
+
+/* fontconfig looks at font and configuration files at most once per */
+/* its rescan interval and reloads the current configuration when */
+/* they changed; *config is then replaced by a reference to it */
+int fontconfig_config_update(FcConfig **config)
+{
+  FcConfig *current;
+
+  if (!FcInitBringUptoDate())
+  {
+    font_specimen_error("fontconfig: can not reload configuration");
+    return -1;
+  }
+
+  current = FcConfigGetCurrent();
+  if (current == *config)
+    return 0;
+
+  if (! (current = FcConfigReference(current)))
+  {
+    font_specimen_error("fontconfig: can not get current configuration");
+    return -1;
+  }
+  FcConfigDestroy(*config);
+  *config = current;
+  return 1;
+}
+
 FcPattern *fontconfig_get_pattern(const char *pattern)
 {
   char sanitized_pattern[2*strlen(pattern)];
@@ -50,7 +102,8 @@ FcPattern *fontconfig_get_pattern(const char *pattern)
   return FcNameParse((FcChar8*)sanitized_pattern);
 }
 
-FcPattern *fontconfig_get_font(FcPattern *pattern)
+/* config NULL: current configuration */
+FcPattern *fontconfig_get_font(FcConfig *config, FcPattern *pattern)
 {
   FcResult r;
   FcPattern *match, *p;
@@ -61,13 +114,13 @@ FcPattern *fontconfig_get_font(FcPattern *pattern)
     return NULL;
   }
 
-  if (!FcConfigSubstitute(NULL, p, FcMatchPattern))
+  if (!FcConfigSubstitute(config, p, FcMatchPattern))
   {
     font_specimen_error("fontconfig: out of memory");
     return NULL;
   }
   FcDefaultSubstitute(p);
-  match = FcFontMatch(NULL, p, &r);
+  match = FcFontMatch(config, p, &r);
   FcPatternDestroy(p);
 
   if (r != FcResultMatch)
@@ -78,6 +131,174 @@ FcPattern *fontconfig_get_font(FcPattern *pattern)
   return match;
 }
 
+void fontconfig_match_cache_init(fontconfig_match_cache_t *cache,
+                                 FcConfig *config)
+{
+  memset(cache, 0, sizeof(fontconfig_match_cache_t));
+  cache->config = config;
+}
+
+static void fontconfig_match_entry_free(fontconfig_match_entry_t *entry)
+{
+  if (! entry->key)
+    return;
+  free(entry->key);
+  FcPatternDestroy(entry->match);
+  entry->key = NULL;
+  entry->match = NULL;
+}
+
+void fontconfig_match_cache_free(fontconfig_match_cache_t *cache)
+{
+  int e;
+
+  for (e = 0; e < FONTCONFIG_MATCH_CACHE_SIZE; e++)
+    fontconfig_match_entry_free(&cache->entries[e]);
+}
+
+void fontconfig_match_cache_set_config(fontconfig_match_cache_t *cache,
+                                       FcConfig *config)
+{
+  fontconfig_match_cache_free(cache);
+  cache->config = config;
+}
+
+FcPattern *fontconfig_match_cached(fontconfig_match_cache_t *cache,
+                                   FcPattern *pattern)
+{
+  fontconfig_match_entry_t *entry;
+  FcPattern *match;
+  char *key;
+  int e;
+
+  if (! (key = (char *)FcNameUnparse(pattern)))
+  {
+    font_specimen_error("fontconfig: out of memory");
+    return NULL;
+  }
+
+  entry = &cache->entries[0];
+  for (e = 0; e < FONTCONFIG_MATCH_CACHE_SIZE; e++)
+  {
+    if (cache->entries[e].key && strcmp(cache->entries[e].key, key) == 0)
+    {
+      free(key);
+      cache->hits++;
+      cache->entries[e].used = ++cache->clock;
+      FcPatternReference(cache->entries[e].match);
+      return cache->entries[e].match;
+    }
+    /* free slot or least recently used one */
+    if (! cache->entries[e].key
+        || (entry->key && cache->entries[e].used < entry->used))
+      entry = &cache->entries[e];
+  }
+
+  cache->misses++;
+  if (! (match = fontconfig_get_font(cache->config, pattern)))
+  {
+    free(key);
+    return NULL;
+  }
+
+  fontconfig_match_entry_free(entry);
+  entry->key = key;
+  entry->match = match;
+  entry->used = ++cache->clock;
+  FcPatternReference(match);
+  return match;
+}
+
+/* by pixel size, then file and index, so that order of strikes */
+/* of the same size does not depend on the order of the listing */
+static int fontconfig_strike_compare(const void *a, const void *b)
+{
+  const fontconfig_strike_t *sa = (const fontconfig_strike_t *)a;
+  const fontconfig_strike_t *sb = (const fontconfig_strike_t *)b;
+  int c;
+
+  if (sa->pxsize != sb->pxsize)
+    return sa->pxsize < sb->pxsize ? -1 : 1;
+  if ((c = strcmp(sa->file, sb->file)) != 0)
+    return c;
+  return sa->index - sb->index;
+}
+
+void fontconfig_free_strikes(fontconfig_strike_t *strikes, int nstrikes)
+{
+  int s;
+
+  for (s = 0; s < nstrikes; s++)
+    free(strikes[s].file);
+  free(strikes);
+}
+
+int fontconfig_get_strikes(FcConfig *config,
+                           const char *family,
+                           const char *style,
+                           fontconfig_strike_t **strikes)
+{
+  FcPattern *p;
+  FcObjectSet *os;
+  FcFontSet *fs;
+  FcChar8 *file;
+  double pxsize;
+  int f, index, nstrikes;
+
+  p = FcPatternBuild(NULL, 
+                     FC_FAMILY, FcTypeString, family, 
+                     FC_STYLE, FcTypeString, style,
+                     FC_FONTFORMAT, FcTypeString, "PCF",
+                     (char *)0);
+  os = FcObjectSetBuild(FC_FILE, FC_INDEX, FC_PIXEL_SIZE, (char *)0);
+  fs = (p && os) ? FcFontList(config, p, os) : NULL;
+  if (p)
+    FcPatternDestroy(p);
+  if (os)
+    FcObjectSetDestroy(os);
+  if (! fs)
+  {
+    font_specimen_error("fontconfig: can not list strikes");
+    return -1;
+  }
+
+  *strikes = malloc((fs->nfont > 0 ? fs->nfont : 1)
+                    *sizeof(fontconfig_strike_t));
+  if (! *strikes)
+  {
+    FcFontSetDestroy(fs);
+    font_specimen_error("fontconfig: out of memory");
+    return -1;
+  }
+
+  nstrikes = 0;
+  for (f = 0; f < fs->nfont; f++)
+  {
+    if (FcPatternGetString(fs->fonts[f], FC_FILE, 0, &file) != FcResultMatch
+        || FcPatternGetDouble(fs->fonts[f], FC_PIXEL_SIZE, 0, &pxsize)
+             != FcResultMatch)
+      continue;
+    if (FcPatternGetInteger(fs->fonts[f], FC_INDEX, 0, &index) 
+          != FcResultMatch)
+      index = 0;
+    if (! ((*strikes)[nstrikes].file = strdup((const char *)file)))
+    {
+      fontconfig_free_strikes(*strikes, nstrikes);
+      FcFontSetDestroy(fs);
+      font_specimen_error("fontconfig: out of memory");
+      return -1;
+    }
+    (*strikes)[nstrikes].pxsize = pxsize;
+    (*strikes)[nstrikes].index = index;
+    nstrikes++;
+  }
+  FcFontSetDestroy(fs);
+
+  qsort(*strikes, nstrikes, sizeof(fontconfig_strike_t), 
+        fontconfig_strike_compare);
+  return nstrikes;
+}
+
 int fontconfig_pattern_set_string(FcPattern *pattern, 
                                    const char *object, 
                                    const char *value)
@@ -228,6 +449,85 @@ void fontconfig_pattern_destroy(FcPattern *pat)
   return;
 }
 
+/* blank characters by charset page, ascending; FcBlanks can */
+/* only be asked char by char. Blanks always come from the default */
+/* configuration and are read once per process; fontconfig 2.13 */
+/* and later has no blanks at all */
+typedef struct
+{
+  uint32_t page;  /* first character of the page */
+  uint32_t map[FC_CHARSET_MAP_SIZE];
+} fontconfig_blank_page_t;
+
+static fontconfig_blank_page_t *fontconfig_blank_pages;
+static int fontconfig_nblank_pages;
+/* set when the pages could not be allocated */
+static FcBlanks *fontconfig_blanks_direct;
+static pthread_once_t fontconfig_blanks_once = PTHREAD_ONCE_INIT;
+
+static void fontconfig_blanks_init(void)
+{
+  FcBlanks *blanks = FcConfigGetBlanks(NULL);
+  fontconfig_blank_page_t *pages;
+  uint32_t ch;
+
+  if (! blanks)
+    return;
+
+  for (ch = 0; ch <= 0x10FFFF; ch++)
+  {
+    if (! FcBlanksIsMember(blanks, ch))
+      continue;
+    if (! fontconfig_nblank_pages 
+        || fontconfig_blank_pages[fontconfig_nblank_pages - 1].page 
+             != (ch & ~0xffU))
+    {
+      pages = realloc(fontconfig_blank_pages, 
+                      (fontconfig_nblank_pages + 1)
+                        *sizeof(fontconfig_blank_page_t));
+      if (! pages)
+      {
+        free(fontconfig_blank_pages);
+        fontconfig_blank_pages = NULL;
+        fontconfig_nblank_pages = 0;
+        fontconfig_blanks_direct = blanks;
+        return;
+      }
+      fontconfig_blank_pages = pages;
+      pages = &pages[fontconfig_nblank_pages++];
+      memset(pages, 0, sizeof(fontconfig_blank_page_t));
+      pages->page = ch & ~0xffU;
+    }
+    fontconfig_blank_pages[fontconfig_nblank_pages - 1].map[(ch & 0xff) >> 5]
+      |= 1U << (ch & 31);
+  }
+}
+
+/* make room for at least more chars, but never for more than max */
+static int fontconfig_chars_grow(uint32_t **chars, uint32_t *size, 
+                                 uint32_t n, uint32_t more, uint32_t max)
+{
+  uint32_t *grown, size_new;
+
+  if (n + more <= *size || *size == max)
+    return 0;
+
+  size_new = *size ? *size : 1024;
+  while (size_new < n + more && size_new < max)
+    size_new *= 2;
+  if (size_new > max)
+    size_new = max;
+
+  if (! (grown = realloc(*chars, size_new*sizeof(uint32_t))))
+  {
+    font_specimen_error("fontconfig: out of memory");
+    return -1;
+  }
+  *chars = grown;
+  *size = size_new;
+  return 0;
+}
+
 /* character set: grid FcTrue, specimen: grid FcFalse */
 /* grid FcTrue: keep blanks + add ' ' where character */
 /* doesn't exist; of course leave out lines (maps) where */
@@ -239,53 +539,48 @@ uint32_t fontconfig_chars(FcPattern *pattern,
                           int grid, 
                           uint32_t maxchars)
 {
-  uint32_t available, nchars, n;
-  FcBlanks *blanks = FcConfigGetBlanks(NULL);
+  uint32_t n, size;
   uint32_t ucs4;
   uint32_t map[FC_CHARSET_MAP_SIZE];
   uint32_t next;
+  uint32_t line;
+  const uint32_t *blank_map;
+  const fontconfig_blank_page_t *blank;
 
   int i, j, left, right;
-  int nlines;
+  int id;
 
   FcCharSet *charset;
   
-  FcPatternGetCharSet(pattern, FC_CHARSET, 0, &charset);
-
-  nlines = 0;
-  for (ucs4 = FcCharSetFirstPage (charset, map, &next);
-       ucs4 != FC_CHARSET_DONE;
-       ucs4 = FcCharSetNextPage (charset, map, &next))
-  {
-    int i;
-    /* for ucs4 == 0, skip i == 0 and i == 4, see below */
-    for (i = (ucs4 == 0 ? 1 : 0);
-         i < FC_CHARSET_MAP_SIZE;
-         ucs4 == 0 && i == 3 ? i = 5 : i++)
-      if (map[i] &&
-          (!uinterval ||
-           unicode_interval_contains(uinterval, uintype, ucs4 + 32*i) ||
-           unicode_interval_contains(uinterval, uintype, ucs4 + 32*i + 0x10)))
-        nlines++;
-  }
-
-  if (grid)
-    available = 32*nlines;
-  else
-    available = FcCharSetCount(charset);
-
-  nchars = available < maxchars ? available : maxchars;
-  *chars = (uint32_t*)malloc(nchars*sizeof(FcChar32));
-
-  if (! *chars)
+  *chars = NULL;
+  if (! maxchars)
+    return 0;
+  if (fontconfig_pattern_get_charset(pattern, &charset) < 0)
     return 0;
+  id = uinterval ? unicode_interval_id(uinterval, uintype) : -1;
 
+  if (! grid)
+    pthread_once(&fontconfig_blanks_once, fontconfig_blanks_init);
+  blank = fontconfig_blank_pages;
+
+  /* one pass, output grows as needed */
+  n = size = 0;
   /* for() code below borrowed from fontconfig-2.10.2/src/fclang.c */
-  n = 0;
   for (ucs4 = FcCharSetFirstPage (charset, map, &next);
        ucs4 != FC_CHARSET_DONE;
        ucs4 = FcCharSetNextPage (charset, map, &next))
   {
+    blank_map = NULL;
+    if (! grid)
+    {
+      while (blank < fontconfig_blank_pages + fontconfig_nblank_pages
+             && blank->page < ucs4)
+        blank++;
+      if (blank < fontconfig_blank_pages + fontconfig_nblank_pages
+          && blank->page == ucs4)
+        blank_map = blank->map;
+    }
+
     /* for some fonts (e. g. Dina) fontconfig reports they contain 
        control characters;  skip them for sure (we get 'wrong unicode 
        character' while converting svg if not) */
@@ -293,32 +588,47 @@ uint32_t fontconfig_chars(FcPattern *pattern,
          i < FC_CHARSET_MAP_SIZE;
          ucs4 == 0 && i == 3 ? i = 5 : i++)
     {
-      if (map[i])
-      {
-        left = 0;
-        right = 32;
-        if (uinterval && !unicode_interval_contains(uinterval, uintype, ucs4 + 32*i))
-          left = 16;
-        if (uinterval && !unicode_interval_contains(uinterval, uintype, ucs4 + 32*i + 16))
-          right = 16;
-
+      if (! map[i])
+        continue;
+
+      /* half of the line is taken when its first character */
+      /* is from the interval */
+      left = 0;
+      right = 32;
+      if (uinterval && !unicode_interval_contains_id(id, uintype, ucs4 + 32*i))
+        left = 16;
+      if (uinterval && !unicode_interval_contains_id(id, uintype, ucs4 + 32*i + 16))
+        right = 16;
+      if (left >= right)
+        continue;
+
+      line = map[i];
+      if (blank_map)
+        line &= ~blank_map[i];
+      if (! grid && fontconfig_blanks_direct)
         for (j = left; j < right; j++)
-        {
-          if (map[i] & (1 << j))
-          {
-            FcChar32 ch = ucs4 + 32*i + j;
+          if (FcBlanksIsMember(fontconfig_blanks_direct, ucs4 + 32*i + j))
+            line &= ~(1U << j);
 
-            if (grid == FcTrue || !FcBlanksIsMember(blanks, ch))
-              (*chars)[n++] = ch;
-
-          }
-          else if (grid == FcTrue)
-            (*chars)[n++] = 0;
-
-          if (n == nchars)
-            return n;
-        }
+      if (fontconfig_chars_grow(chars, &size, n, right - left, maxchars) < 0)
+      {
+        free(*chars);
+        *chars = NULL;
+        return 0;
       }
+
+      if (grid)
+        for (j = left; j < right && n < maxchars; j++)
+          (*chars)[n++] = line & (1U << j) ? ucs4 + 32*i + j : 0;
+      else
+        /* set bits of [left, right) only */
+        for (line &= (left ? 0xffff0000U : ~0U) & (right == 32 ? ~0U : 0xffffU);
+             line && n < maxchars;
+             line &= line - 1)
+          (*chars)[n++] = ucs4 + 32*i + __builtin_ctz(line);
+
+      if (n == maxchars)
+        return n;
     }
   }
 
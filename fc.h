@@ -28,9 +28,59 @@
 #include <fontconfig/fontconfig.h>
 #include <inttypes.h>
 
+#define FONTCONFIG_MATCH_CACHE_SIZE  8
+
+/* font matched for a requested pattern */
+typedef struct
+{
+  char *key;           /* FcNameUnparse() of the request, NULL if free */
+  FcPattern *match;    /* holds one reference */
+  unsigned long used;  /* last use, for LRU eviction */
+} fontconfig_match_entry_t;
+
+/* matches of one configuration; not thread safe */
+typedef struct
+{
+  FcConfig *config;
+  fontconfig_match_entry_t entries[FONTCONFIG_MATCH_CACHE_SIZE];
+  unsigned long clock;
+  unsigned long hits;
+  unsigned long misses;
+} fontconfig_match_cache_t;
+
+/* one size of a bitmap font */
+typedef struct
+{
+  double pxsize;
+  char *file;
+  int index;
+} fontconfig_strike_t;
+
 void fontconfig_version(char* version, int version_max);
+FcConfig *fontconfig_config_reference(void);
+void fontconfig_config_destroy(FcConfig *config);
+/* 1 when *config was replaced by a newer one, 0 when up to date */
+int fontconfig_config_update(FcConfig **config);
 FcPattern *fontconfig_get_pattern(const char *pattern);
-FcPattern *fontconfig_get_font(FcPattern *pattern);
+FcPattern *fontconfig_get_font(FcConfig *config, FcPattern *pattern);
+void fontconfig_match_cache_init(fontconfig_match_cache_t *cache,
+                                 FcConfig *config);
+void fontconfig_match_cache_free(fontconfig_match_cache_t *cache);
+/* forgets the matches made with the old configuration */
+void fontconfig_match_cache_set_config(fontconfig_match_cache_t *cache,
+                                       FcConfig *config);
+/* as fontconfig_get_font(cache->config, pattern), but the result */
+/* is shared: it must not be modified, fontconfig_pattern_destroy() */
+/* releases it */
+FcPattern *fontconfig_match_cached(fontconfig_match_cache_t *cache,
+                                   FcPattern *pattern);
+/* strikes of family and style, ascending by pixel size; */
+/* returns their number or -1 */
+int fontconfig_get_strikes(FcConfig *config,
+                           const char *family,
+                           const char *style,
+                           fontconfig_strike_t **strikes);
+void fontconfig_free_strikes(fontconfig_strike_t *strikes, int nstrikes);
 
 int fontconfig_pattern_set_string(FcPattern *pattern, 
                                    const char *object, 
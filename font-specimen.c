@@ -25,9 +25,39 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <inttypes.h>
 
 #include "specimen.h"
 
+/* parses comma separated list of png filters, -1 on error */
+int parse_png_filters(const char *list)
+{
+  const char *names[] = { "none", "sub", "up", "avg", "paeth", "all", NULL };
+  const int bits[] = { SPECIMEN_PNG_FILTER_NONE, 
+                       SPECIMEN_PNG_FILTER_SUB,
+                       SPECIMEN_PNG_FILTER_UP,
+                       SPECIMEN_PNG_FILTER_AVG,
+                       SPECIMEN_PNG_FILTER_PAETH,
+                       SPECIMEN_PNG_FILTER_ALL };
+  int filters = 0, n, len;
+
+  while (*list)
+  {
+    len = strcspn(list, ",");
+    for (n = 0; names[n]; n++)
+      if (strlen(names[n]) == len && strncmp(list, names[n], len) == 0)
+        break;
+    if (! names[n])
+      return -1;
+    filters |= bits[n];
+    list += len;
+    if (*list == ',')
+      list++;
+  }
+
+  return filters ? filters : -1;
+}
+
 /* removes spaces and slashes from string */
 void remove_spaces_and_slashes(char *string)
 {
@@ -54,32 +84,100 @@ void remove_spaces_and_slashes(char *string)
   return;
 }
 
+/* specimen_stats_t of the context as JSON */
+void print_stats(specimen_context_t *context, FILE *out)
+{
+  specimen_stats_t st;
+
+  specimen_context_stats(context, &st);
+  fprintf(out, "{\n");
+  fprintf(out, "  \"match_ns\": %" PRIu64 ",\n", st.match_ns);
+  fprintf(out, "  \"coverage_ns\": %" PRIu64 ",\n", st.coverage_ns);
+  fprintf(out, "  \"sentence_ns\": %" PRIu64 ",\n", st.sentence_ns);
+  fprintf(out, "  \"shaping_ns\": %" PRIu64 ",\n", st.shaping_ns);
+  fprintf(out, "  \"glyph_load_ns\": %" PRIu64 ",\n", st.glyph_load_ns);
+  fprintf(out, "  \"raster_ns\": %" PRIu64 ",\n", st.raster_ns);
+  fprintf(out, "  \"blend_ns\": %" PRIu64 ",\n", st.blend_ns);
+  fprintf(out, "  \"rotate_ns\": %" PRIu64 ",\n", st.rotate_ns);
+  fprintf(out, "  \"encode_ns\": %" PRIu64 ",\n", st.encode_ns);
+  fprintf(out, "  \"glyphs\": %lu,\n", st.glyphs);
+  fprintf(out, "  \"glyph_cache_hits\": %lu,\n", st.glyph_cache_hits);
+  fprintf(out, "  \"glyph_cache_misses\": %lu,\n", st.glyph_cache_misses);
+  fprintf(out, "  \"match_cache_hits\": %lu,\n", st.match_cache_hits);
+  fprintf(out, "  \"match_cache_misses\": %lu,\n", st.match_cache_misses);
+  fprintf(out, "  \"bytes_allocated\": %" PRIu64 ",\n", st.bytes_allocated);
+  fprintf(out, "  \"bytes_written\": %" PRIu64 "\n", st.bytes_written);
+  fprintf(out, "}\n");
+}
+
+/* stats go to their own file or to stderr, stdout is for -l */
+int write_stats(specimen_context_t *context, const char *statsname)
+{
+  FILE *out;
+
+  if (! statsname)
+  {
+    print_stats(context, stderr);
+    return 0;
+  }
+
+  out = fopen(statsname, "w");
+  if (! out)
+  {
+    fprintf(stderr, "Can not open %s.\n", statsname);
+    return -1;
+  }
+  print_stats(context, out);
+  fclose(out);
+  return 0;
+}
+
 void usage(const char *err)
 {
   if (err)
     fprintf(stderr, "ERROR: %s\n\n", err);
-  fprintf(stderr, "Usage: font-specimen [-d] -p pattern [-option1 value1 [...]]\n");
-  fprintf(stderr, "       font-specimen [-d] -l\n");
+  fprintf(stderr, "Usage: font-specimen [-d] [-v | -V file] -p pattern [-option1 value1 [...]]\n");
+  fprintf(stderr, "       font-specimen [-d] [-v | -V file] -l\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "       Generates specimen for given font and\n");
-  fprintf(stderr, "       writes it to PNG file.\n");
+  fprintf(stderr, "       writes it to PNG (or PNM, QOI) file.\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "       -p  string:  fontconfig-like pattern including rendering options\n");
   fprintf(stderr, "                    [mandatory; otherwise usage is displayed]\n");
   fprintf(stderr, "       -s  string:  unicode script name to take the sentence from\n");
   fprintf(stderr, "                    [default value: the most coveraged script]\n");
   fprintf(stderr, "       -o  string:  name of the file\n");
-  fprintf(stderr, "                    [default value: ${pattern}-${script}.png]\n");
+  fprintf(stderr, "                    [default value: ${pattern}-${script}.${format}]\n");
   fprintf(stderr, "       -t  string:  type of specimen [waterfall, compact]\n");
   fprintf(stderr, "                    [default value: compact]\n");
   fprintf(stderr, "       -w  int:     width of the PNG, 0 for auto\n");
   fprintf(stderr, "                    [default value: 0]\n");
   fprintf(stderr, "       -h  int:     height of th PNG, 0 for auto\n");
   fprintf(stderr, "                    [default value: 0]\n");
+  fprintf(stderr, "       -f  string:  image format [png, pnm, qoi]\n");
+  fprintf(stderr, "                    [default value: png]\n");
+  fprintf(stderr, "       -b  int:     render in bands of given rows to bound memory,\n");
+  fprintf(stderr, "                    0 for whole image at once\n");
+  fprintf(stderr, "                    [default value: 0]\n");
+  fprintf(stderr, "       -e  string:  PNG encoder preset [default, fastest]\n");
+  fprintf(stderr, "                    [default value: default]\n");
+  fprintf(stderr, "       -c  int:     zlib compression level 0 to 9\n");
+  fprintf(stderr, "                    [default value: from preset]\n");
+  fprintf(stderr, "       -F  string:  comma separated PNG row filters\n");
+  fprintf(stderr, "                    [none, sub, up, avg, paeth, all]\n");
+  fprintf(stderr, "                    [default value: from preset]\n");
+  fprintf(stderr, "       -S  string:  zlib strategy\n");
+  fprintf(stderr, "                    [default, filtered, rle, huffman]\n");
+  fprintf(stderr, "                    [default value: from preset]\n");
+  fprintf(stderr, "       -j  int:     threads compressing the PNG\n");
+  fprintf(stderr, "                    [default value: 1]\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "       -l           lists significant scripts and its coverage for\n");
   fprintf(stderr, "                    given font (do not write any png)\n");
   fprintf(stderr, "       -d           print errors\n");
+  fprintf(stderr, "       -v           print per-stage timings and counters\n");
+  fprintf(stderr, "                    as JSON to stderr\n");
+  fprintf(stderr, "       -V  string:  write them to given file instead\n");
 
 }
 
@@ -92,22 +190,40 @@ int main(int argc, char *argv[])
   const char *script;
   specimen_type_t type;
   int width, height;  
+  int band;
+  specimen_format_t format;
+  const char *extension;
+  specimen_png_preset_t preset;
+  int level, filters, strategy, threads;
+  specimen_png_options_t png_options;
 
   int script_list;
+  int verbose;
+  const char *statsname;
 
   char pngname[FILENAME_MAX];
   const char *scripts[maxscripts];
   double coverages[maxscripts];
   int s, nscripts;
   FILE *png;
+  specimen_context_t *context;
+  int ret;
 
   pattern = NULL;
   script_list = 0;
+  verbose = 0;
+  statsname = NULL;
   script = NULL;
   pngname[0] = '\0';
   width = height = 0;
+  band = 0;
+  format = SPECIMEN_FORMAT_PNG;
+  extension = "png";
+  preset = SPECIMEN_PNG_PRESET_DEFAULT;
+  level = filters = strategy = -1;
+  threads = 1;
   type = SPECIMEN_COMPACT;
-  while ((opt = getopt(argc, argv, "p:s:o:lt:w:h:d")) != -1)
+  while ((opt = getopt(argc, argv, "p:s:o:lt:w:h:f:b:e:c:F:S:j:dvV:")) != -1)
   {
     switch (opt)
     {
@@ -151,12 +267,91 @@ int main(int argc, char *argv[])
           return 1;
         }
         break;
+      case 'f':
+        if (strcmp(optarg, "png") == 0)
+          format = SPECIMEN_FORMAT_PNG;
+        else if (strcmp(optarg, "pnm") == 0)
+          format = SPECIMEN_FORMAT_PNM;
+        else if (strcmp(optarg, "qoi") == 0)
+          format = SPECIMEN_FORMAT_QOI;
+        else
+        {
+          usage("Wrong image format.");
+          return 1;
+        }
+        extension = optarg;
+        break;
+      case 'b':
+        band = atoi(optarg);
+        if (band < 0)
+        {
+          usage("Wrong band height.");
+          return 1;
+        }
+        break;
+      case 'e':
+        if (strcmp(optarg, "default") == 0)
+          preset = SPECIMEN_PNG_PRESET_DEFAULT;
+        else if (strcmp(optarg, "fastest") == 0)
+          preset = SPECIMEN_PNG_PRESET_FASTEST;
+        else
+        {
+          usage("Wrong encoder preset.");
+          return 1;
+        }
+        break;
+      case 'c':
+        level = atoi(optarg);
+        if (level < 0 || level > 9)
+        {
+          usage("Wrong compression level.");
+          return 1;
+        }
+        break;
+      case 'F':
+        filters = parse_png_filters(optarg);
+        if (filters < 0)
+        {
+          usage("Wrong PNG filters.");
+          return 1;
+        }
+        break;
+      case 'S':
+        if (strcmp(optarg, "default") == 0)
+          strategy = SPECIMEN_PNG_STRATEGY_DEFAULT;
+        else if (strcmp(optarg, "filtered") == 0)
+          strategy = SPECIMEN_PNG_STRATEGY_FILTERED;
+        else if (strcmp(optarg, "rle") == 0)
+          strategy = SPECIMEN_PNG_STRATEGY_RLE;
+        else if (strcmp(optarg, "huffman") == 0)
+          strategy = SPECIMEN_PNG_STRATEGY_HUFFMAN_ONLY;
+        else
+        {
+          usage("Wrong zlib strategy.");
+          return 1;
+        }
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        if (threads < 1)
+        {
+          usage("Wrong number of threads.");
+          return 1;
+        }
+        break;
       case 'd':
         specimen_set_debug(1);
         break;
       case 'l':
         script_list = 1;
         break;
+      case 'v':
+        verbose = 1;
+        break;
+      case 'V':
+        verbose = 1;
+        statsname = optarg;
+        break;
     }
   }
 
@@ -166,12 +361,34 @@ int main(int argc, char *argv[])
     return 1;
   }
 
-  nscripts = specimen_font_scripts(pattern, SCRIPT_SORT_PERCENT, 
-                                   scripts, coverages, maxscripts);
+  context = specimen_context_create();
+  if (!context)
+  {
+    fprintf(stderr, "Can not initialize font-specimen.\n");
+    return 1;
+  }
+
+  specimen_context_set_timing(context, verbose);
+  specimen_context_set_band_height(context, band);
+  specimen_context_set_format(context, format);
+
+  specimen_png_options_init(&png_options, preset);
+  if (level >= 0)
+    png_options.level = level;
+  if (filters >= 0)
+    png_options.filters = filters;
+  if (strategy >= 0)
+    png_options.strategy = strategy;
+  png_options.threads = threads;
+  specimen_context_set_png_options(context, &png_options);
+
+  ret = 1;
+  nscripts = specimen_font_scripts_ctx(context, pattern, SCRIPT_SORT_PERCENT, 
+                                       scripts, coverages, maxscripts);
   if (nscripts < 0)
   {
     fprintf(stderr, "Can not get list of scripts from the font.\n");
-    return 1;
+    goto done;
   }
 
   if (script_list)
@@ -179,7 +396,7 @@ int main(int argc, char *argv[])
     if (nscripts == 0)
     {
       fprintf(stderr, "No valid scripts detected in the font.\n");
-      return 1;
+      goto done;
     }
 
     for (s = 0; s < nscripts; s++)
@@ -187,8 +404,9 @@ int main(int argc, char *argv[])
       fprintf(stdout, "%s (%.1f)\n",
               scripts[s], coverages[s]);
     }
-  
-    return 0;
+
+    ret = 0;
+    goto done;
   }
 
   if (!script)
@@ -198,7 +416,7 @@ int main(int argc, char *argv[])
     else
     {
       fprintf(stderr, "No script found in given font.\n");
-      return 1;
+      goto done;
     }
   }
   else
@@ -210,14 +428,14 @@ int main(int argc, char *argv[])
     if (s == nscripts)
     {
       fprintf(stderr, "Given script not found in the font.\n");
-      return 1;
+      goto done;
     }
   }
 
 
   if (pngname[0] == '\0')
   {
-    snprintf(pngname, FILENAME_MAX, "%s-%s.png", pattern, script);
+    snprintf(pngname, FILENAME_MAX, "%s-%s.%s", pattern, script, extension);
     remove_spaces_and_slashes(pngname);
   }
 
@@ -227,15 +445,25 @@ int main(int argc, char *argv[])
   if (!png)
   {
     fprintf(stderr, "Can not open %s.\n", pngname);
-    return 1;
+    goto done;
   }
 
-  if (specimen_write(type, pattern, script, png, width, height) < 0)
+  if (specimen_write_ctx(context, type, pattern, script, 
+                         png, width, height) < 0)
   {
     fprintf(stderr, "Can not write specimen.\n");
-    return 1;
+    fclose(png);
+    goto done;
   }
 
-  return 0;
+  fclose(png);
+  ret = 0;
+
+done:
+  /* stats of a failed run tell where it stopped */
+  if (verbose && write_stats(context, statsname) < 0)
+    ret = 1;
+  specimen_context_destroy(context);
+  return ret;
 }
 
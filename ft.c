@@ -21,6 +21,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -30,6 +32,7 @@
 
 #include "ft.h"
 #include "hbz.h"
+#include "raster.h"
 #include "fc.h"
 #include "error.h"
 
@@ -49,48 +52,198 @@ char *freetype_version(char *string, int maxlen)
   return string;
 }
 
-int ft_initialize_bitmap(bitmap_t *bitmap, int height, int width, 
-                         int ord, int lcdfilter)
+int ft_initialize_context(ft_context_t *context, FcConfig *config)
 {
-  int row;
-
   FT_Error err;
 
-  if (lay_horizontal(ord))
-    width *= 3;
+  err = FT_Init_FreeType(&context->library);
+  if (err)
+  {
+    font_specimen_error("freetype: can not initialize library");
+    return -1;
+  }
 
-  if (lay_vertical(ord))
-    height *= 3;
+  context->config = config;
+  context->nfaces = 0;
+  context->nstrikes = 0;
+  context->clock = 0;
+  context->serial = 0;
+  memset(&context->glyphs, 0, sizeof(ft_glyph_cache_t));
+  memset(&context->stats, 0, sizeof(ft_stats_t));
+  return 0;
+}
 
-  bitmap->data = (unsigned char **)malloc(height*sizeof(unsigned char *));
-  if (! bitmap->data)
+/* start of a measured stage, 0 when not timing */
+static uint64_t ft_stats_start(ft_context_t *context)
+{
+  return context->stats.timing ? font_specimen_clock() : 0;
+}
+
+static void ft_stats_stop(ft_context_t *context, uint64_t *ns, uint64_t start)
+{
+  if (context->stats.timing)
+    *ns += font_specimen_clock() - start;
+}
+
+static void ft_glyph_cache_clear(ft_glyph_cache_t *cache)
+{
+  ft_glyph_entry_t *entry, *next;
+
+  for (entry = cache->lru_first; entry; entry = next)
+  {
+    next = entry->lru_next;
+    FT_Done_Glyph((FT_Glyph)entry->glyph);
+    free(entry);
+  }
+  memset(cache->buckets, 0, sizeof(cache->buckets));
+  cache->lru_first = cache->lru_last = NULL;
+  cache->size = 0;
+}
+
+static void ft_face_entry_free(ft_face_entry_t *entry)
+{
+  hbz_font_destroy(entry->hbz);
+  entry->hbz = NULL;
+  FT_Done_Face(entry->face);
+  free(entry->file);
+  entry->face = NULL;
+  entry->file = NULL;
+}
+
+/* leave entry as a free slot; other entries keep their places, */
+/* bitmaps point to them */
+static void ft_context_drop_face(ft_context_t *context,
+                                 ft_face_entry_t *entry)
+{
+  entry->face = NULL;
+  entry->file = NULL;
+  entry->hbz = NULL;
+  if (entry == &context->faces[context->nfaces - 1])
+    context->nfaces--;
+}
+
+static void ft_strikes_entry_free(ft_strikes_entry_t *entry)
+{
+  fontconfig_free_strikes(entry->strikes, entry->nstrikes);
+  free(entry->family);
+  free(entry->style);
+  entry->strikes = NULL;
+  entry->nstrikes = 0;
+  entry->family = NULL;
+  entry->style = NULL;
+}
+
+void ft_free_context(ft_context_t *context)
+{
+  int f;
+
+  ft_glyph_cache_clear(&context->glyphs);
+
+  for (f = 0; f < context->nfaces; f++)
+    ft_face_entry_free(&context->faces[f]);
+  context->nfaces = 0;
+
+  for (f = 0; f < context->nstrikes; f++)
+    ft_strikes_entry_free(&context->strikes[f]);
+  context->nstrikes = 0;
+
+  FT_Done_FreeType(context->library);
+  context->library = NULL;
+  context->config = NULL;
+}
+
+/* opened faces are kept, they are looked up by file name; */
+/* strikes were listed by the old configuration */
+void ft_context_set_config(ft_context_t *context, FcConfig *config)
+{
+  int s;
+
+  for (s = 0; s < context->nstrikes; s++)
+    ft_strikes_entry_free(&context->strikes[s]);
+  context->nstrikes = 0;
+  context->config = config;
+}
+
+/* one aligned block for band rows of the canvas (all of them */
+/* for band == 0), filled with white */
+static int ft_bitmap_alloc(bitmap_t *bitmap, int height, int width, int band)
+{
+  int row, stride, rows;
+  void *buffer;
+
+  rows = (band > 0 && band < height) ? band : height;
+
+  stride = (width + FT_BITMAP_ALIGN - 1) & ~(FT_BITMAP_ALIGN - 1);
+  /* one spare alignment unit: never ask for zero bytes */
+  if (posix_memalign(&buffer, FT_BITMAP_ALIGN,
+                     (size_t)stride*rows + FT_BITMAP_ALIGN))
   {
     font_specimen_error("freetype: no free memory");
     return -1;
   }
+  bitmap->buffer = (unsigned char *)buffer;
+  bitmap->stride = stride;
 
-  for (row = 0; row < height; row++)
+  bitmap->data = (unsigned char **)malloc((rows + 1)*sizeof(unsigned char *));
+  if (! bitmap->data)
   {
-    bitmap->data[row] = (unsigned char *)malloc(width*sizeof(unsigned char));
-    if (! bitmap->data[row])
-    {
-      font_specimen_error("freetype: out of memory");
-      return -1;
-    }
-    memset(bitmap->data[row], 255, width*sizeof(unsigned char)); /* white */
+    font_specimen_error("freetype: no free memory");
+    free(bitmap->buffer);
+    return -1;
   }
 
+  for (row = 0; row < rows; row++)
+    bitmap->data[row] = bitmap->buffer + (size_t)row*bitmap->stride;
+
+  memset(bitmap->buffer, 255, (size_t)bitmap->stride*rows); /* white */
+
   bitmap->height = height;
   bitmap->width = width;
+  bitmap->band_top = 0;
+  bitmap->band_rows = rows;
+  return 0;
+}
 
-  err = FT_Init_FreeType(&bitmap->library);
-  if (err)
+int ft_initialize_bitmap(bitmap_t *bitmap, ft_context_t *context,
+                         int height, int width, int ord, int lcdfilter,
+                         int rot270, int band)
+{
+  FT_Error err;
+
+  if (lay_horizontal(ord))
+    width *= 3;
+
+  if (lay_vertical(ord))
   {
-    font_specimen_error("freetype: can not initialize library");
-    return -1;
+    height *= 3;
+    band *= 3; /* keep subpixel row triples in one band */
   }
 
+  if (rot270)
+  {
+    if (ft_bitmap_alloc(bitmap, width, height, band) < 0)
+      return -1;
+  }
+  else
+  {
+    if (ft_bitmap_alloc(bitmap, height, width, band) < 0)
+      return -1;
+  }
+  context->stats.bytes_allocated 
+    += (uint64_t)bitmap->stride*bitmap->band_rows + FT_BITMAP_ALIGN
+       + (bitmap->band_rows + 1)*sizeof(unsigned char *);
+
+  bitmap->rot270 = rot270;
+  bitmap->scratch = NULL;
+  bitmap->scratch_size = 0;
+
+  memset(bitmap->values, 0, sizeof(bitmap->values));
+  bitmap->values[255] = 1; /* white */
+
+  bitmap->context = context;
+  bitmap->entry = NULL;
   bitmap->face = NULL;
+  bitmap->lcdfilter = lcdfilter;
 
   bitmap->load_flags = FT_LOAD_DEFAULT;
   bitmap->render_mode = FT_RENDER_MODE_NORMAL;
@@ -98,7 +251,7 @@ int ft_initialize_bitmap(bitmap_t *bitmap, int height, int width,
   /* these are common for whole specimen image */
   if (lay_color(ord))
   {
-    err = FT_Library_SetLcdFilter(bitmap->library, lcdfilter);
+    err = FT_Library_SetLcdFilter(context->library, lcdfilter);
     if (err)
     {
       font_specimen_error("freetype: can not set lcd filter");
@@ -124,6 +277,352 @@ int ft_initialize_bitmap(bitmap_t *bitmap, int height, int width,
   return 0;
 }
 
+void ft_glyph_cache_stats(ft_context_t *context,
+                          unsigned long *hits, unsigned long *misses)
+{
+  if (hits)
+    *hits = context->glyphs.hits;
+  if (misses)
+    *misses = context->glyphs.misses;
+}
+
+static unsigned ft_glyph_hash(unsigned face_serial, int pxsize,
+                              FT_UInt glyph_index, FT_Int32 load_flags,
+                              FT_Render_Mode render_mode, int lcdfilter)
+{
+  unsigned h;
+
+  h = face_serial;
+  h = h*31 + pxsize;
+  h = h*31 + glyph_index;
+  h = h*31 + (unsigned)load_flags;
+  h = h*31 + render_mode;
+  h = h*31 + lcdfilter;
+  return (h ^ (h >> 16)) % FT_GLYPH_CACHE_BUCKETS;
+}
+
+static void ft_glyph_lru_unlink(ft_glyph_cache_t *cache, 
+                                ft_glyph_entry_t *entry)
+{
+  if (entry->lru_prev)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    cache->lru_first = entry->lru_next;
+  if (entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    cache->lru_last = entry->lru_prev;
+}
+
+static void ft_glyph_lru_push(ft_glyph_cache_t *cache,
+                              ft_glyph_entry_t *entry)
+{
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_first;
+  if (cache->lru_first)
+    cache->lru_first->lru_prev = entry;
+  else
+    cache->lru_last = entry;
+  cache->lru_first = entry;
+}
+
+/* drop least recently used glyphs until there is room for size */
+static void ft_glyph_cache_shrink(ft_glyph_cache_t *cache, size_t size)
+{
+  ft_glyph_entry_t *entry, **link;
+
+  while (cache->lru_last && cache->size + size > FT_GLYPH_CACHE_BYTES)
+  {
+    entry = cache->lru_last;
+    link = &cache->buckets[ft_glyph_hash(entry->face_serial,
+                                         entry->pxsize,
+                                         entry->glyph_index,
+                                         entry->load_flags,
+                                         entry->render_mode,
+                                         entry->lcdfilter)];
+    while (*link != entry)
+      link = &(*link)->hash_next;
+    *link = entry->hash_next;
+
+    ft_glyph_lru_unlink(cache, entry);
+    cache->size -= entry->size;
+    FT_Done_Glyph((FT_Glyph)entry->glyph);
+    free(entry);
+  }
+}
+
+/* return rendered glyph for current font of the bitmap, */
+/* load and render it only when it is not cached yet */
+static ft_glyph_entry_t *ft_bitmap_glyph(bitmap_t *bitmap, 
+                                         FT_UInt glyph_index)
+{
+  ft_glyph_cache_t *cache = &bitmap->context->glyphs;
+  ft_glyph_entry_t *entry;
+  unsigned h;
+  FT_Glyph glyph;
+  FT_Error err;
+  int monochrome;
+  uint64_t start;
+
+  h = ft_glyph_hash(bitmap->entry->serial, bitmap->entry->pxsize,
+                    glyph_index, bitmap->load_flags,
+                    bitmap->render_mode, bitmap->lcdfilter);
+
+  for (entry = cache->buckets[h]; entry; entry = entry->hash_next)
+  {
+    if (entry->face_serial == bitmap->entry->serial &&
+        entry->pxsize == bitmap->entry->pxsize &&
+        entry->glyph_index == glyph_index &&
+        entry->load_flags == bitmap->load_flags &&
+        entry->render_mode == bitmap->render_mode &&
+        entry->lcdfilter == bitmap->lcdfilter)
+    {
+      cache->hits++;
+      ft_glyph_lru_unlink(cache, entry);
+      ft_glyph_lru_push(cache, entry);
+      return entry;
+    }
+  }
+
+  cache->misses++;
+
+  start = ft_stats_start(bitmap->context);
+  err = FT_Load_Glyph(bitmap->face, glyph_index, bitmap->load_flags);
+  if (err)
+  {
+    font_specimen_error("freetype: can not load glyph");
+    return NULL;
+  }
+
+  err = FT_Get_Glyph(bitmap->face->glyph, &glyph);
+  if (err)
+  {
+    font_specimen_error("freetype: can not get glyph");
+    return NULL;
+  }
+  ft_stats_stop(bitmap->context, &bitmap->context->stats.glyph_load_ns, start);
+
+  monochrome = 0;
+  if (bitmap->render_mode == FT_RENDER_MODE_MONO || 
+      glyph->format == FT_GLYPH_FORMAT_BITMAP)
+  {
+    monochrome = 1;
+  }
+
+  start = ft_stats_start(bitmap->context);
+  err = FT_Glyph_To_Bitmap(&glyph, bitmap->render_mode, NULL, 1);
+  ft_stats_stop(bitmap->context, &bitmap->context->stats.raster_ns, start);
+  if (err)
+  {
+    font_specimen_error("freetype: can not render glyph");
+    FT_Done_Glyph(glyph);
+    return NULL;
+  }
+
+  entry = (ft_glyph_entry_t *)malloc(sizeof(ft_glyph_entry_t));
+  if (! entry)
+  {
+    font_specimen_error("freetype: out of memory");
+    FT_Done_Glyph(glyph);
+    return NULL;
+  }
+
+  entry->face_serial = bitmap->entry->serial;
+  entry->pxsize = bitmap->entry->pxsize;
+  entry->glyph_index = glyph_index;
+  entry->load_flags = bitmap->load_flags;
+  entry->render_mode = bitmap->render_mode;
+  entry->lcdfilter = bitmap->lcdfilter;
+  entry->glyph = (FT_BitmapGlyph)glyph;
+  entry->monochrome = monochrome;
+  entry->size = sizeof(ft_glyph_entry_t) +
+                (size_t)abs(entry->glyph->bitmap.pitch) * 
+                entry->glyph->bitmap.rows;
+
+  ft_glyph_cache_shrink(cache, entry->size);
+
+  entry->hash_next = cache->buckets[h];
+  cache->buckets[h] = entry;
+  ft_glyph_lru_push(cache, entry);
+  cache->size += entry->size;
+  bitmap->context->stats.bytes_allocated += entry->size;
+  return entry;
+}
+
+/* return opened face for (file, index); faces stay opened */
+/* in the context until they are the least recently used ones */
+/* and room is needed for another */
+static ft_face_entry_t *ft_context_face(ft_context_t *context,
+                                        const char *file,
+                                        int index)
+{
+  int f, lru, unused;
+  ft_face_entry_t *entry;
+  FT_Error err;
+
+  context->clock++;
+
+  lru = unused = -1;
+  for (f = 0; f < context->nfaces; f++)
+  {
+    entry = &context->faces[f];
+    if (! entry->file)
+    {
+      unused = f;
+      continue;
+    }
+    if (entry->index == index && strcmp(entry->file, file) == 0)
+    {
+      entry->used = context->clock;
+      return entry;
+    }
+    if (lru < 0 || entry->used < context->faces[lru].used)
+      lru = f;
+  }
+
+  if (unused >= 0)
+    entry = &context->faces[unused];
+  else if (context->nfaces < FT_FACE_CACHE_SIZE)
+    entry = &context->faces[context->nfaces++];
+  else
+  {
+    entry = &context->faces[lru];
+    ft_face_entry_free(entry);
+  }
+
+  err = FT_New_Face(context->library, file, index, &entry->face);
+  if (err)
+  {
+    font_specimen_error("freetype: can not create face object");
+    ft_context_drop_face(context, entry);
+    return NULL;
+  }
+
+  entry->file = strdup(file);
+  if (! entry->file)
+  {
+    font_specimen_error("freetype: out of memory");
+    FT_Done_Face(entry->face);
+    ft_context_drop_face(context, entry);
+    return NULL;
+  }
+
+  entry->index = index;
+  entry->hbz = NULL;
+  entry->pxsize = 0;
+  entry->serial = ++context->serial;
+  entry->used = context->clock;
+  return entry;
+}
+
+static hbz_font_t *ft_face_entry_hbz(ft_face_entry_t *entry)
+{
+  if (! entry->hbz)
+    entry->hbz = hbz_font_create(entry->face, entry->pxsize);
+  return entry->hbz;
+}
+
+/* strikes of the bitmap family and style, listed on first use */
+static ft_strikes_entry_t *ft_context_strikes(ft_context_t *context,
+                                              const char *family,
+                                              const char *style)
+{
+  int s, lru, unused;
+  ft_strikes_entry_t *entry;
+
+  context->clock++;
+
+  lru = unused = -1;
+  for (s = 0; s < context->nstrikes; s++)
+  {
+    entry = &context->strikes[s];
+    if (! entry->family)
+    {
+      unused = s;
+      continue;
+    }
+    if (strcmp(entry->family, family) == 0 
+        && strcmp(entry->style, style) == 0)
+    {
+      entry->used = context->clock;
+      return entry;
+    }
+    if (lru < 0 || entry->used < context->strikes[lru].used)
+      lru = s;
+  }
+
+  if (unused >= 0)
+    entry = &context->strikes[unused];
+  else if (context->nstrikes < FT_STRIKE_CACHE_SIZE)
+    entry = &context->strikes[context->nstrikes++];
+  else
+  {
+    entry = &context->strikes[lru];
+    ft_strikes_entry_free(entry);
+  }
+
+  entry->family = strdup(family);
+  entry->style = strdup(style);
+  entry->nstrikes = -1;
+  if (entry->family && entry->style)
+    entry->nstrikes = fontconfig_get_strikes(context->config, family, style,
+                                             &entry->strikes);
+  else
+    font_specimen_error("freetype: out of memory");
+  if (entry->nstrikes <= 0)
+  {
+    if (entry->nstrikes == 0)
+    {
+      font_specimen_error("freetype: no strikes of bitmap font");
+      free(entry->strikes);
+    }
+    entry->strikes = NULL;
+    entry->nstrikes = 0;
+    ft_strikes_entry_free(entry);
+    /* free slot, found again by the lookup above */
+    if (entry == &context->strikes[context->nstrikes - 1])
+      context->nstrikes--;
+    return NULL;
+  }
+
+  entry->used = context->clock;
+  return entry;
+}
+
+/* strike nearest to pxsize, the smaller one of two as near; */
+/* of more files of that size, the file/index given, if listed */
+static const fontconfig_strike_t *ft_strikes_nearest(ft_strikes_entry_t *entry,
+                                                     int pxsize,
+                                                     const char *file,
+                                                     int index)
+{
+  int s, best;
+  double d, best_d;
+
+  best = 0;
+  best_d = -1.0;
+  for (s = 0; s < entry->nstrikes; s++)
+  {
+    d = entry->strikes[s].pxsize - pxsize;
+    if (d < 0)
+      d = -d;
+    if (best_d < 0 || d < best_d)
+    {
+      best = s;
+      best_d = d;
+    }
+  }
+  /* strikes are sorted, the ones of the same size follow best */
+  for (s = best; 
+       s < entry->nstrikes && 
+         entry->strikes[s].pxsize == entry->strikes[best].pxsize; 
+       s++)
+    if (entry->strikes[s].index == index &&
+        strcmp(entry->strikes[s].file, file) == 0)
+      return &entry->strikes[s];
+  return &entry->strikes[best];
+}
+
 int ft_bitmap_set_font(bitmap_t *bitmap, 
                        FcPattern *pattern, 
                        int pxsize,
@@ -143,16 +642,20 @@ int ft_bitmap_set_font(bitmap_t *bitmap,
   const char *style;
   const char *file; 
   const char *fontformat;
-  double size, real_size;
+  int index;
+  double size;
+  ft_strikes_entry_t *strikes;
+  const fontconfig_strike_t *strike;
 
   FT_Error err;
-  FcPattern *font, *p;
 
-  if (bitmap->face)
-    FT_Done_Face(bitmap->face);
+  bitmap->entry = NULL;
+  bitmap->face = NULL;
 
   if (fontconfig_pattern_get_string(pattern, FC_FILE, &file) < 0)
     return -1;
+  if (fontconfig_pattern_get_integer(pattern, FC_INDEX, &index) < 0)
+    index = 0;
 
   if (! pxsize)
   {
@@ -165,52 +668,47 @@ int ft_bitmap_set_font(bitmap_t *bitmap,
     return -1;
   if (strcmp(fontformat, "PCF") == 0)
   {
-    /* let fontconfig return nearest size for given size and
-       bitmap font */
+    /* every size of bitmap font is another file; */
+    /* take the nearest one, pattern is left untouched */
     if (fontconfig_pattern_get_string(pattern, FC_FAMILY, &family) < 0)
       return -1;
     if (fontconfig_pattern_get_string(pattern, FC_STYLE, &style) < 0)
       return -1;
 
-    if (!(p = fontconfig_pattern_new()))
-      return -1;
-    if (fontconfig_pattern_set_string(p, FC_FAMILY, family) < 0)
-      return -1;
-    if (fontconfig_pattern_set_string(p, FC_STYLE, style) < 0)
-      return -1;
-    if (fontconfig_pattern_set_double(p, FC_SIZE, (double)pxsize) < 0)
-      return -1;
-    if (! (font = fontconfig_get_font(p)))
-      return -1;
-    fontconfig_pattern_destroy(p);
-
-    if (fontconfig_pattern_get_double(font, FC_PIXEL_SIZE, &real_size) < 0)
-      return -1;
-    if (fontconfig_pattern_set_double(pattern, FC_PIXEL_SIZE, real_size) < 0)
-      return -1;
-
-    pxsize = (int)real_size;
-
-    if (fontconfig_pattern_get_string(font, FC_FILE, &file) < 0)
-      return -1;
-    if (fontconfig_pattern_set_string(pattern, FC_FILE, file) < 0)
+    if (! (strikes = ft_context_strikes(bitmap->context, family, style)))
       return -1;
+    strike = ft_strikes_nearest(strikes, pxsize, file, index);
+    /* matched file has the size: keep it, other files of */
+    /* the same size may differ in encoding and charset */
+    if (fontconfig_pattern_get_double(pattern, FC_PIXEL_SIZE, &size) < 0 ||
+        size != strike->pxsize)
+    {
+      file = strike->file;
+      index = strike->index;
+    }
+    pxsize = (int)strike->pxsize;
   }
 
   bitmap->grayscale = grayscale;
+  raster_gray_lut(bitmap->gray_lut, grayscale);
 
-  err = FT_New_Face(bitmap->library, (char *)file, 0, &bitmap->face);
-  if (err)
-  {
-    font_specimen_error("freetype: can not create face object");
+  bitmap->entry = ft_context_face(bitmap->context, file, index);
+  if (! bitmap->entry)
     return -1;
-  }
+  bitmap->face = bitmap->entry->face;
 
-  err = FT_Set_Pixel_Sizes(bitmap->face, 0, pxsize);
-  if (err)
+  if (bitmap->entry->pxsize != pxsize)
   {
-    font_specimen_error("freetype: can not set face size");
-    return -1;
+    err = FT_Set_Pixel_Sizes(bitmap->face, 0, pxsize);
+    if (err)
+    {
+      font_specimen_error("freetype: can not set face size");
+      bitmap->entry->pxsize = 0;
+      return -1;
+    }
+    bitmap->entry->pxsize = pxsize;
+    if (bitmap->entry->hbz)
+      hbz_font_set_size(bitmap->entry->hbz, pxsize);
   }
 
   if (fontconfig_pattern_get_bool(pattern, FC_SCALABLE, &scalable) < 0)
@@ -255,6 +753,8 @@ int ft_bitmap_set_font(bitmap_t *bitmap,
 
   bitmap->text_direction = text_direction;
   bitmap->script = script;
+  /* resolved once here, not on every shaping */
+  bitmap->script_tag = script && script[0] ? unicode_script_tag(script) : 0;
   bitmap->lang = lang;
 
   if (text_direction >= 2)
@@ -265,232 +765,470 @@ int ft_bitmap_set_font(bitmap_t *bitmap,
 
 int ft_reduce_height(bitmap_t *bitmap, int new_height)
 {
-  int row;
-
   if (new_height < 0 || new_height > bitmap->height)
   {
     font_specimen_error("freetype: can not reduce height (wrong new_height)");
     return -1;
   }
 
-  for (row = bitmap->height - 1; row > new_height - 1; row--)
-    free(bitmap->data[row]);
+  if (bitmap->rot270)
+  {
+    /* drawing height is canvas width, rows would have to move */
+    font_specimen_error("freetype: can not reduce height of rotated bitmap");
+    return -1;
+  }
+
+  if (bitmap->band_rows < bitmap->height)
+  {
+    font_specimen_error("freetype: can not reduce height of banded bitmap");
+    return -1;
+  }
+
   bitmap->height = new_height; 
+  bitmap->band_rows = new_height;
   return 0;
 }
 
+int ft_bitmap_band_rows(const bitmap_t *bitmap)
+{
+  int rows = bitmap->height - bitmap->band_top;
+
+  return rows < bitmap->band_rows ? rows : bitmap->band_rows;
+}
+
+void ft_bitmap_band(bitmap_t *bitmap, int top)
+{
+  bitmap->band_top = top;
+  memset(bitmap->buffer, 255, 
+         (size_t)bitmap->stride*ft_bitmap_band_rows(bitmap)); /* white */
+}
+
+void ft_bitmap_image_size(const bitmap_t *bitmap, 
+                          int *width, int *height, int *channels)
+{
+  *width  = lay_horizontal(bitmap->ord) ? bitmap->width / 3  : bitmap->width;
+  *height = lay_vertical(bitmap->ord)   ? bitmap->height / 3 : bitmap->height;
+  *channels = lay_color(bitmap->ord) ? 3 : 1;
+}
+
+int ft_bitmap_image_rows(const bitmap_t *bitmap)
+{
+  /* vertical layout takes rows by three, incomplete triple is left out */
+  if (lay_vertical(bitmap->ord))
+    return ft_bitmap_band_rows(bitmap) / 3;
+  return ft_bitmap_band_rows(bitmap);
+}
+
+const unsigned char *ft_bitmap_image_row(const bitmap_t *bitmap, int row, 
+                                         unsigned char *pixels)
+{
+  int i, len;
+  unsigned char tmp;
+
+  /* canvas row is the image row */
+  if (! lay_vertical(bitmap->ord) && ! lay_bgr(bitmap->ord))
+    return bitmap->data[row];
+
+  if (lay_vertical(bitmap->ord))
+  {
+    len = 3*bitmap->width;
+    for (i = 0; i < bitmap->width; i++)
+    {
+      pixels[3*i]     = bitmap->data[3*row    ][i];
+      pixels[3*i + 1] = bitmap->data[3*row + 1][i];
+      pixels[3*i + 2] = bitmap->data[3*row + 2][i];
+    }
+  }
+  else
+  {
+    len = bitmap->width;
+    if (pixels != bitmap->data[row])
+      memcpy(pixels, bitmap->data[row], len);
+  }
+
+  if (lay_bgr(bitmap->ord))
+  {
+    for (i = 0; i < len; i += 3)
+    {
+      tmp = pixels[i];
+      pixels[i] = pixels[i + 2];
+      pixels[i + 2] = tmp;
+    }
+  }
+  return pixels;
+}
+
 void ft_free_bitmap(bitmap_t *bitmap)
 {
-  int row;
-  for (row = 0; row < bitmap->height; row++)
-    free(bitmap->data[row]);
+  free(bitmap->buffer);
   free(bitmap->data);
+  free(bitmap->scratch);
 
+  bitmap->buffer = NULL;
   bitmap->data = NULL;
+  bitmap->scratch = NULL;
+  bitmap->scratch_size = 0;
+  bitmap->stride = 0;
   bitmap->height = 0;
   bitmap->width = 0;
+  bitmap->band_top = 0;
+  bitmap->band_rows = 0;
 
-  FT_Done_Face(bitmap->face);
-  FT_Done_FreeType(bitmap->library);
+  /* face is owned by bitmap->context */
+  bitmap->entry = NULL;
+  bitmap->face = NULL;
   bitmap->load_flags = 0;
 }
 
-void draw_bitmap(FT_Bitmap *glyph,
-                 FT_Int x,
-                 FT_Int y, 
-                 bitmap_t bitmap,
-                 int monochrome)
+/* rotate glyph to bitmap->scratch; mono glyph is expanded */
+/* to 0 and 255 first, which blends the same as the bits */
+static int ft_scratch_rot270(FT_Bitmap *glyph, bitmap_t *bitmap, 
+                             int monochrome)
 {
-  FT_Int i, j, p, q;
-  FT_Int x_max, y_max;
+  size_t size, need;
+  unsigned char *src, *dst;
+  int row, col, pitch;
+
+  size = (size_t)glyph->width*glyph->rows;
+  need = monochrome ? 2*size : size;
+  if (need > bitmap->scratch_size)
+  {
+    dst = realloc(bitmap->scratch, need);
+    if (! dst)
+    {
+      font_specimen_error("freetype: out of memory");
+      return -1;
+    }
+    bitmap->context->stats.bytes_allocated += need - bitmap->scratch_size;
+    bitmap->scratch = dst;
+    bitmap->scratch_size = need;
+  }
+
+  src = glyph->buffer;
+  pitch = glyph->pitch;
+  if (monochrome)
+  {
+    src = bitmap->scratch + size;
+    pitch = glyph->width;
+    for (row = 0; row < glyph->rows; row++)
+      for (col = 0; col < glyph->width; col++)
+        src[row*pitch + col] 
+          = (glyph->buffer[row*glyph->pitch + (col >> 3)] 
+              & (128 >> (col & 7))) ? 255 : 0;
+  }
 
-  if (lay_horizontal(bitmap.ord))
+  raster_rot270(bitmap->scratch, glyph->rows, src, pitch,
+                glyph->width, glyph->rows);
+  return 0;
+}
+
+/* where glyph drawn at (x, y) of the drawing lands on the canvas */
+static void ft_glyph_canvas(const FT_Bitmap *glyph, int x, int y,
+                            const bitmap_t *bitmap,
+                            int *canvas_x, int *canvas_y,
+                            int *width, int *rows)
+{
+  if (lay_horizontal(bitmap->ord))
     x *= 3;
-  if (lay_vertical(bitmap.ord))
+  if (lay_vertical(bitmap->ord))
     y *= 3;
 
-  x_max = x + glyph->width;
-  y_max = y + glyph->rows;
-
-  for (i = x, p = 0; i < x_max; i++, p++)
+  if (bitmap->rot270)
   {
-    for (j = y, q = 0; j < y_max; j++, q++)
-    {
-      if (i < 0 || j < 0 ||
-          i >= bitmap.width || j >= bitmap.height)
-        continue;
-
-      if (monochrome)
-      {
-        if (glyph->buffer[glyph->pitch * q + (p >> 3)] & (128 >> (p & 7)))
-        {
-          bitmap.data[j][i] = ~(~bitmap.data[j][i] | (255*bitmap.grayscale/100));
-        }
-      }
-      else
-      {
-        bitmap.data[j][i] &= ~((char)((int)glyph->buffer[q * glyph->pitch + p]*bitmap.grayscale/100));
-      }
-    }
+    /* glyph in drawing coordinates, rotated the same way */
+    /* as the whole drawing */
+    *canvas_x = bitmap->width - y - glyph->rows;
+    *canvas_y = x;
+    *width = glyph->rows;
+    *rows = glyph->width;
+  }
+  else
+  {
+    *canvas_x = x;
+    *canvas_y = y;
+    *width = glyph->width;
+    *rows = glyph->rows;
   }
 }
 
-static int ft_draw_text_(uint32_t text[], int x,  int y,
-                         bitmap_t *bitmap, FT_Bool dry);
+int draw_bitmap(FT_Bitmap *glyph,
+                FT_Int x,
+                FT_Int y, 
+                bitmap_t *bitmap,
+                int monochrome)
+{
+  FT_Int left, top, right, bottom;
+  int width, rows, pitch;
+  unsigned char *dst;
+  const unsigned char *src;
+  uint64_t start;
+
+  ft_glyph_canvas(glyph, x, y, bitmap, &x, &y, &width, &rows);
+  y -= bitmap->band_top;
+  pitch = bitmap->rot270 ? width : glyph->pitch;
+
+  /* clip glyph to the canvas band, in glyph coordinates */
+  left = x < 0 ? -x : 0;
+  top = y < 0 ? -y : 0;
+  right = width;
+  if (x + right > bitmap->width)
+    right = bitmap->width - x;
+  bottom = rows;
+  if (y + bottom > ft_bitmap_band_rows(bitmap))
+    bottom = ft_bitmap_band_rows(bitmap) - y;
+
+  if (left >= right || top >= bottom)
+    return 0;
+
+  src = glyph->buffer;
+  if (bitmap->rot270)
+  {
+    start = ft_stats_start(bitmap->context);
+    if (ft_scratch_rot270(glyph, bitmap, monochrome) < 0)
+      return -1;
+    ft_stats_stop(bitmap->context, &bitmap->context->stats.rotate_ns, start);
+    src = bitmap->scratch;
+    monochrome = 0;
+  }
+
+  dst = bitmap->buffer + (size_t)(y + top)*bitmap->stride + x + left;
+  src += top*pitch;
+
+  start = ft_stats_start(bitmap->context);
+  if (monochrome)
+    raster_blend_mono(dst, bitmap->stride, src, pitch, left,
+                      right - left, bottom - top, bitmap->gray_lut);
+  else
+    raster_blend_gray(dst, bitmap->stride, src + left, pitch,
+                      right - left, bottom - top, 
+                      bitmap->grayscale, bitmap->gray_lut);
+  ft_stats_stop(bitmap->context, &bitmap->context->stats.blend_ns, start);
+  return 0;
+}
 
-int ft_draw_text(uint32_t text[], int x,  int y, bitmap_t *bitmap)
+int text_length(uint32_t text[])
 {
-  return ft_draw_text_(text, x, y, bitmap, 0);
+  int len = 0;
+  while (text[len])
+    len++;
+  return len;
 }
 
-int ft_text_length(uint32_t text[], FcPattern *pattern, int pxsize,
+/* advance width of text, from the (cached) shaping result only */
+int ft_text_length(ft_context_t *context, uint32_t text[],
+                   FcPattern *pattern, int pxsize,
                    int dir, const char *script, const char *lang)
 {
   bitmap_t bitmap;
+  hbz_font_t *hbz;
+  const hbz_glyphs_t *shaped;
   int len;
-  if (ft_initialize_bitmap(&bitmap, 0, 0, FC_RGBA_UNKNOWN, FC_LCD_NONE) < 0)
+  uint64_t start;
+
+  if (ft_initialize_bitmap(&bitmap, context, 0, 0,
+                           FC_RGBA_UNKNOWN, FC_LCD_NONE, 0, 0) < 0)
     return -1;
+
+  len = -1;
   if (ft_bitmap_set_font(&bitmap, pattern, pxsize, 1.0,
                          dir, script, lang) < 0)
-    return -1;
-  len = ft_draw_text_(text, 0, 0, &bitmap, 1);
+    goto done;
+  if (! (hbz = ft_face_entry_hbz(bitmap.entry)))
+    goto done;
+  start = ft_stats_start(context);
+  shaped = hbz_glyphs(hbz, text, text_length(text), 
+                      bitmap.script_tag, lang, dir);
+  ft_stats_stop(context, &context->stats.shaping_ns, start);
+  if (! shaped)
+    goto done;
+
+  /* one of operands is zero */
+  len = (shaped->sum_advances_x + (-shaped->sum_advances_y)) >> 6;
+  if (len < 0)
+    len = 0;
+
+done:
   ft_free_bitmap(&bitmap);
   return len;
 }
 
-int text_length(uint32_t text[])
+void ft_free_layout(ft_layout_t *layout)
 {
-  int len = 0;
-  while (text[len])
-    len++;
-  return len;
+  free(layout->glyphs);
+  layout->glyphs = NULL;
+  layout->nglyphs = 0;
+  layout->maxglyphs = 0;
 }
 
-/* dry true: do not draw the bitmap, only return string length */
-static int ft_draw_text_(uint32_t text[], int x,  int y,
-                  bitmap_t *bitmap, FT_Bool dry)
+/* values the canvas may hold after the glyph is blended: */
+/* mono glyph and-s them with one mask, gray glyph gives any */
+static void ft_bitmap_glyph_values(bitmap_t *bitmap, int monochrome)
+{
+  unsigned char mask = bitmap->gray_lut[255];
+  int v;
+
+  if (! monochrome)
+  {
+    memset(bitmap->values, 1, sizeof(bitmap->values));
+    return;
+  }
+
+  /* v & mask <= v, so new values are never visited again */
+  for (v = 0; v < 256; v++)
+    if (bitmap->values[v])
+      bitmap->values[v & mask] = 1;
+}
+
+/* place glyphs of the text with the current font of the bitmap, */
+/* glyphs outside of the canvas are left out; return text length */
+int ft_layout_text(uint32_t text[], int x, int y, bitmap_t *bitmap,
+                   int string, ft_layout_t *layout)
 {
-  FT_Error err;
   FT_Vector pen;
 
-  FT_UInt *glyph_codepoints;
-  FT_Vector *glyph_offsets;
-  FT_Vector *glyph_advances;
-  FT_Vector *glyph_positions;
-  FT_Glyph *glyphs;
+  const hbz_glyphs_t *shaped;
+  ft_glyph_place_t *place;
+  ft_glyph_entry_t *glyph;
   FT_BitmapGlyph bit;
+  hbz_font_t *hbz;
 
-  int monochrome;
-  int nglyphs, g;
-  int sum_advances_x, sum_advances_y;
+  int g, gx, gy;
+  int canvas_x, canvas_y, width, rows;
   int text_width;
+  uint64_t start;
 
   text_width = 0;
-  nglyphs = hbz_glyphs(text, 
-                       text_length(text), 
-                       bitmap->script, 
-                       bitmap->lang, 
-                       bitmap->text_direction,
-                       bitmap->face, 
-                       &glyph_codepoints, 
-                       &glyph_offsets,
-                       &glyph_advances,
-                       &sum_advances_x,
-                       &sum_advances_y);
-
-  if (nglyphs == -1)
+  if (! (hbz = ft_face_entry_hbz(bitmap->entry)))
     return -1;
 
-  glyph_positions = malloc(nglyphs*sizeof(FT_Vector));
-  glyphs = malloc(nglyphs*sizeof(FT_Glyph));
-  if (glyph_positions == NULL || glyphs == NULL)
-  {
-    font_specimen_error("freetype: out of memory");
+  start = ft_stats_start(bitmap->context);
+  shaped = hbz_glyphs(hbz,
+                      text, 
+                      text_length(text), 
+                      bitmap->script_tag, 
+                      bitmap->lang, 
+                      bitmap->text_direction);
+  ft_stats_stop(bitmap->context, &bitmap->context->stats.shaping_ns, start);
+
+  if (! shaped)
     return -1;
+
+  if (layout->nglyphs + shaped->nglyphs > layout->maxglyphs)
+  {
+    place = realloc(layout->glyphs, 
+                    (layout->nglyphs + shaped->nglyphs)*2
+                      *sizeof(ft_glyph_place_t));
+    if (! place)
+    {
+      font_specimen_error("freetype: out of memory");
+      return -1;
+    }
+    bitmap->context->stats.bytes_allocated 
+      += ((layout->nglyphs + shaped->nglyphs)*2 - layout->maxglyphs)
+         *sizeof(ft_glyph_place_t);
+    layout->glyphs = place;
+    layout->maxglyphs = (layout->nglyphs + shaped->nglyphs)*2;
   }
 
   pen.x = x << 6;
   if (bitmap->text_direction == 1)
-    pen.x -= sum_advances_x;
+    pen.x -= shaped->sum_advances_x;
   pen.y = y << 6;
   if (bitmap->text_direction == 3)
-    pen.y -= (-sum_advances_y);
+    pen.y -= (-shaped->sum_advances_y);
   if (bitmap->text_direction == 2)
-    pen.y -= glyph_advances[0].y - glyph_offsets[0].y;
-  for (g = 0; g < nglyphs; g++)
+    pen.y -= shaped->advances[0].y - shaped->offsets[0].y;
+
+  for (g = 0; g < shaped->nglyphs; g++)
   {
-    glyph_positions[g].x = (pen.x + glyph_offsets[g].x) >> 6;
-    glyph_positions[g].y = (pen.y - glyph_offsets[g].y) >> 6;
-    pen.x += glyph_advances[g].x;
-    pen.y -= glyph_advances[g].y;
+    gx = (pen.x + shaped->offsets[g].x) >> 6;
+    gy = (pen.y - shaped->offsets[g].y) >> 6;
+    pen.x += shaped->advances[g].x;
+    pen.y -= shaped->advances[g].y;
 
-    err = FT_Load_Glyph(bitmap->face, 
-                          glyph_codepoints[g], bitmap->load_flags);
-    if (err)
-    {
-      font_specimen_error("freetype: can not load glyph");
-      return -1;
-    }
- 
-    err = FT_Get_Glyph(bitmap->face->glyph, &glyphs[g]);
-    if (err)
-    {
-      font_specimen_error("freetype: can not get glyph");
+    glyph = ft_bitmap_glyph(bitmap, shaped->codepoints[g]);
+    if (! glyph)
       return -1;
-    }
+
+    bit = glyph->glyph;
+    gx += bit->left;
+    gy -= bit->top;
+    ft_glyph_canvas(&bit->bitmap, gx, gy, bitmap, 
+                    &canvas_x, &canvas_y, &width, &rows);
+    if (width <= 0 || rows <= 0 ||
+        canvas_x >= bitmap->width || canvas_x + width <= 0 ||
+        canvas_y >= bitmap->height || canvas_y + rows <= 0)
+      continue;
+
+    place = &layout->glyphs[layout->nglyphs++];
+    place->glyph_index = shaped->codepoints[g];
+    place->string = string;
+    place->x = gx;
+    place->y = gy;
+    place->top = canvas_y > 0 ? canvas_y : 0;
+    place->bottom = canvas_y + rows < bitmap->height 
+                    ? canvas_y + rows : bitmap->height;
+    ft_bitmap_glyph_values(bitmap, glyph->monochrome);
   }
 
   /* one of operands is zero */
-  text_width = (sum_advances_x + (-sum_advances_y)) >> 6;
+  text_width = (shaped->sum_advances_x + (-shaped->sum_advances_y)) >> 6;
+  if (text_width < 0)
+    text_width = 0;
+  return text_width;
+}
 
-  free(glyph_codepoints);
-  free(glyph_offsets);
-  free(glyph_advances);
+/* draw placed glyph, bitmap has to have the font it was placed with */
+int ft_draw_glyph(const ft_glyph_place_t *place, bitmap_t *bitmap)
+{
+  ft_glyph_entry_t *glyph;
 
-  if (! dry)
-  {
-    for (g = 0; g < nglyphs; g++)
-    {
-      monochrome = 0;
-      if (bitmap->render_mode == FT_RENDER_MODE_MONO || 
-          glyphs[g]->format == FT_GLYPH_FORMAT_BITMAP)
-      {
-        monochrome = 1;
-      }
-
-      err = FT_Glyph_To_Bitmap(&glyphs[g], bitmap->render_mode, 
-                                 NULL, 1);
-      if (err)
-      {
-        font_specimen_error("freetype: can not render glyph");
-        return -1;
-      }
-
-      bit = (FT_BitmapGlyph)glyphs[g];
-      draw_bitmap(&bit->bitmap, 
-                  glyph_positions[g].x + bit->left, 
-                  glyph_positions[g].y - bit->top, 
-                  *bitmap, monochrome);
+  glyph = ft_bitmap_glyph(bitmap, place->glyph_index);
+  if (! glyph)
+    return -1;
 
+  return draw_bitmap(&glyph->glyph->bitmap, place->x, place->y,
+                     bitmap, glyph->monochrome);
+}
 
-    }
-  }
+/* draw text to the bitmap, return its length */
+int ft_draw_text(uint32_t text[], int x,  int y, bitmap_t *bitmap)
+{
+  ft_layout_t layout = { NULL, 0, 0 };
+  int g, text_width;
 
-  free(glyph_positions);
-  free(glyphs);
+  text_width = ft_layout_text(text, x, y, bitmap, 0, &layout);
+  for (g = 0; text_width >= 0 && g < layout.nglyphs; g++)
+    if (ft_draw_glyph(&layout.glyphs[g], bitmap) < 0)
+      text_width = -1;
 
-  if (text_width < 0)
-    text_width = 0;
+  ft_free_layout(&layout);
   return text_width;
 }
 
 void ft_fill_region(bitmap_t *bitmap, int left, int top, 
                     int right, int bottom, unsigned char gray)
 {
-  int i, j;
+  int i, j, tmp;
+
+  bitmap->values[gray] = 1;
+
+  if (bitmap->rot270)
+  {
+    /* region of the drawing to region of the canvas */
+    tmp = left;
+    left = bitmap->width - 1 - bottom;
+    bottom = right;
+    right = bitmap->width - 1 - top;
+    top = tmp;
+  }
+
+  /* rows of the current band */
+  top -= bitmap->band_top;
+  bottom -= bitmap->band_top;
 
   if (left >= bitmap->width ||
-      top  >= bitmap->height ||
+      top  >= ft_bitmap_band_rows(bitmap) ||
       right < 0 ||
       bottom < 0)
     return;
@@ -501,54 +1239,10 @@ void ft_fill_region(bitmap_t *bitmap, int left, int top,
     top = 0;
   if (right >= bitmap->width)
     right = bitmap->width - 1;
-  if (bottom >= bitmap->height)
-    bottom = bitmap->height - 1;
+  if (bottom >= ft_bitmap_band_rows(bitmap))
+    bottom = ft_bitmap_band_rows(bitmap) - 1;
 
   for (i = left; i <= right; i++)
     for (j = top; j <= bottom; j++)
       bitmap->data[j][i] = gray;
 }
-
-int ft_rot270(bitmap_t *bitmap)
-{
-  int tmp;
-  int row, col;
-  unsigned char **data;
-
-  data = bitmap->data;
-
-  tmp = bitmap->height;
-  bitmap->height = bitmap->width;
-  bitmap->width = tmp;
-
-  bitmap->data 
-    = (unsigned char **)malloc(bitmap->height*sizeof(unsigned char *));
-  if (! bitmap->data)
-  {
-    font_specimen_error("freetype: no free memory");
-    return -1;
-  }
-
-  for (row = 0; row < bitmap->height; row++)
-  {
-    bitmap->data[row]
-      = (unsigned char *)malloc(bitmap->width*sizeof(unsigned char));
-    if (! bitmap->data[row])
-    {
-      font_specimen_error("freetype: no free memory");
-      return -1;
-    }
-  }
-
-  for (row = 0; row < bitmap->height; row++)
-    for (col = 0; col < bitmap->width; col++)
-      bitmap->data[row][bitmap->width-col-1] = data[col][row];
-
-  /* bitmap->width is now former bitmap->height */
-  for (row = 0; row < bitmap->width; row++)
-    free(data[row]);
-  free(data);
-
-  return 0;
-}
-
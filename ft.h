@@ -30,22 +30,123 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_LCD_FILTER_H
+#include FT_GLYPH_H
+
+#include "hbz.h"
+#include "fc.h"
 
 #define lay_color(ord)      (FC_RGBA_UNKNOWN < ord && ord < FC_RGBA_NONE)
 #define lay_horizontal(ord) (ord == FC_RGBA_RGB || ord == FC_RGBA_BGR)
 #define lay_vertical(ord)   (ord == FC_RGBA_VRGB || ord == FC_RGBA_VBGR)
 #define lay_bgr(ord)        (ord == FC_RGBA_BGR || ord == FC_RGBA_VBGR)
 
+#define FT_FACE_CACHE_SIZE  8
+
+/* opened face, identified by (file, index) */
+typedef struct
+{
+  char *file;
+  int index;
+  FT_Face face;
+  hbz_font_t *hbz;     /* created on first shaping */
+  int pxsize;          /* size currently set on the face */
+  unsigned serial;     /* unique for every opened face */
+  unsigned long used;  /* last use, for LRU eviction */
+} ft_face_entry_t;
+
+#define FT_STRIKE_CACHE_SIZE  4
+
+/* available sizes of one bitmap (PCF) family and style */
+typedef struct
+{
+  char *family;
+  char *style;
+  fontconfig_strike_t *strikes; /* ascending by pixel size */
+  int nstrikes;
+  unsigned long used;  /* last use, for LRU eviction */
+} ft_strikes_entry_t;
+
+#define FT_GLYPH_CACHE_BUCKETS  1024
+#define FT_GLYPH_CACHE_BYTES    (8*1024*1024)
+
+/* rendered glyph, identified by the face, size, glyph index */
+/* and the way it was loaded and rendered */
+typedef struct ft_glyph_entry
+{
+  unsigned face_serial;
+  int pxsize;
+  FT_UInt glyph_index;
+  FT_Int32 load_flags;
+  FT_Render_Mode render_mode;
+  int lcdfilter;
+
+  FT_BitmapGlyph glyph;
+  int monochrome;
+  size_t size;
+
+  struct ft_glyph_entry *hash_next;
+  struct ft_glyph_entry *lru_prev;  /* more recently used */
+  struct ft_glyph_entry *lru_next;  /* less recently used */
+} ft_glyph_entry_t;
+
+typedef struct
+{
+  ft_glyph_entry_t *buckets[FT_GLYPH_CACHE_BUCKETS];
+  ft_glyph_entry_t *lru_first;
+  ft_glyph_entry_t *lru_last;
+  size_t size;
+  unsigned long hits;
+  unsigned long misses;
+} ft_glyph_cache_t;
+
+/* where the time of freetype stages goes, in nanoseconds; */
+/* measured only when timing is set */
 typedef struct
 {
-  unsigned char **data;
+  int timing;
+  uint64_t shaping_ns;
+  uint64_t glyph_load_ns;
+  uint64_t raster_ns;  /* FT_Glyph_To_Bitmap() */
+  uint64_t blend_ns;
+  uint64_t rotate_ns;  /* glyphs of vertical scripts */
+  uint64_t bytes_allocated; /* canvas, layout, glyph cache, scratch */
+} ft_stats_t;
+
+/* long-lived freetype state shared by all specimens of one context */
+typedef struct
+{
+  FT_Library library;
+  FcConfig *config;
+
+  ft_face_entry_t faces[FT_FACE_CACHE_SIZE];
+  int nfaces;
+  ft_strikes_entry_t strikes[FT_STRIKE_CACHE_SIZE];
+  int nstrikes;
+  unsigned long clock;
+  unsigned serial;
+
+  ft_glyph_cache_t glyphs;
+  ft_stats_t stats;
+} ft_context_t;
+
+#define FT_BITMAP_ALIGN  64
+
+typedef struct
+{
+  unsigned char *buffer; /* band_rows rows, stride bytes each */
+  int stride;
+  unsigned char **data;  /* row pointers into buffer */
   int width;
   int height;
+  int band_top;  /* canvas row held in data[0] */
+  int band_rows; /* height when whole canvas is held */
 
   /* current font */
-  FT_Library library;
+  ft_context_t *context;
+  ft_face_entry_t *entry;
   FT_Face face;
   int grayscale; /* 0.0 to 1.0 */
+  unsigned char gray_lut[256]; /* see raster_gray_lut() */
   int text_direction;
   const char *script;
   uint32_t script_tag;
@@ -53,12 +154,49 @@ typedef struct
   FT_Int32 load_flags;
   FT_Render_Mode render_mode;
   int ord;
+  int lcdfilter;
+
+  /* canvas holds the drawing rotated by 270 degrees: */
+  /* drawing (x, y) is stored at data[x][width - 1 - y] */
+  int rot270;
+  unsigned char *scratch; /* glyph rotated for drawing */
+  size_t scratch_size;
+
+  /* values[v] != 0 when canvas pixels may end up v; known */
+  /* for the whole canvas once all its glyphs are laid out */
+  unsigned char values[256];
 } bitmap_t;
 
+/* glyph placed on the canvas, not drawn yet */
+typedef struct
+{
+  FT_UInt glyph_index;
+  int string;  /* caller's number of the text */
+  int x;       /* glyph bitmap origin in drawing coordinates, */
+  int y;       /* as passed to draw_bitmap() */
+  int top;     /* canvas rows covered, [top, bottom), clipped */
+  int bottom;
+} ft_glyph_place_t;
+
+typedef struct
+{
+  ft_glyph_place_t *glyphs;
+  int nglyphs;
+  int maxglyphs;
+} ft_layout_t;
+
 /* pxsize == 0 -> don't initialize face */
 char *freetype_version(char *string, int maxlen);
-int ft_initialize_bitmap(bitmap_t *bitmap, int height, int width, 
-                         int ord, int lcdfilter);
+int ft_initialize_context(ft_context_t *context, FcConfig *config);
+void ft_free_context(ft_context_t *context);
+void ft_context_set_config(ft_context_t *context, FcConfig *config);
+void ft_glyph_cache_stats(ft_context_t *context,
+                          unsigned long *hits, unsigned long *misses);
+/* height and width are those of the drawing, not of rotated canvas; */
+/* band > 0 holds only that many pixel rows of the image in memory */
+int ft_initialize_bitmap(bitmap_t *bitmap, ft_context_t *context,
+                         int height, int width, int ord, int lcdfilter,
+                         int rot270, int band);
 int ft_bitmap_set_font(bitmap_t *bitmap, 
                        FcPattern *pattern,
                        int pxsize,
@@ -67,13 +205,30 @@ int ft_bitmap_set_font(bitmap_t *bitmap,
                        const char *script, 
                        const char *lang);
 int ft_reduce_height(bitmap_t *bitmap, int newheight);
+/* move the band to start at canvas row top and clear it */
+void ft_bitmap_band(bitmap_t *bitmap, int top);
+/* rows of the canvas currently held */
+int ft_bitmap_band_rows(const bitmap_t *bitmap);
+/* the image is gray, or RGB for subpixel layouts (channels == 3) */
+void ft_bitmap_image_size(const bitmap_t *bitmap, 
+                          int *width, int *height, int *channels);
+/* image rows of the current band and one of them as image pixels: */
+/* the canvas row when it needs no conversion, else converted into */
+/* pixels (may be bitmap->data[row] for in place conversion) */
+int ft_bitmap_image_rows(const bitmap_t *bitmap);
+const unsigned char *ft_bitmap_image_row(const bitmap_t *bitmap, int row, 
+                                         unsigned char *pixels);
 void ft_free_bitmap(bitmap_t *bitmap);
 
-int ft_text_length(uint32_t text[], FcPattern *pattern, int pxsize,
+int ft_text_length(ft_context_t *context, uint32_t text[],
+                   FcPattern *pattern, int pxsize,
                    int dir, const char *script, const char *lang);
 int ft_draw_text(uint32_t text[], int x, int y, bitmap_t *bitmap);
+int ft_layout_text(uint32_t text[], int x, int y, bitmap_t *bitmap,
+                   int string, ft_layout_t *layout);
+int ft_draw_glyph(const ft_glyph_place_t *place, bitmap_t *bitmap);
+void ft_free_layout(ft_layout_t *layout);
 
 void ft_fill_region(bitmap_t *bitmap, int left, int top, 
                     int right, int bottom, unsigned char gray);
-int ft_rot270(bitmap_t *bitmap);
 #endif
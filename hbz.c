@@ -29,6 +29,49 @@
 #include <hb.h>
 #include <hb-ft.h>
 
+#include <stdlib.h>
+#include <string.h>
+
+#define HBZ_PLANS_MAX      8
+#define HBZ_SHAPINGS_MAX  32
+
+typedef struct
+{
+  hb_segment_properties_t props;
+  hb_shape_plan_t *plan;
+} hbz_plan_t;
+
+/* shaping result together with everything it depends on */
+typedef struct hbz_shaping
+{
+  uint32_t hash;
+  int pxsize;
+  text_dir_t dir;
+  uint32_t script_tag;
+  const char *lang;
+  const uint32_t *text;
+  int slen;
+
+  hbz_glyphs_t glyphs;
+  struct hbz_shaping *next; /* less recently used */
+} hbz_shaping_t;
+
+struct hbz_font
+{
+  hb_font_t *font;
+  hb_buffer_t *buffer;
+  int pxsize;
+
+  /* plans for (script, language, direction) shaped so far */
+  hbz_plan_t plans[HBZ_PLANS_MAX];
+  int nplans;
+  int next_plan; /* slot to replace when plans are full */
+
+  /* most recently used first */
+  hbz_shaping_t *shapings;
+  int nshapings;
+};
+
 static int hbz_direction(int dir)
 {
   switch (dir)
@@ -46,59 +89,160 @@ const char *hbz_version(void)
   return HB_VERSION_STRING;
 }
 
-unsigned hbz_glyphs(uint32_t s[], 
-                    int slen,
-                    const char *script, 
-                    const char *lang,
-                    text_dir_t dir, 
-                    FT_Face face,
-                    FT_UInt **glyph_codepoints, 
-                    FT_Vector **glyph_offsets, 
-                    FT_Vector **glyph_advances,
-                    int *advances_sum_x,
-                    int *advances_sum_y)
+hbz_font_t *hbz_font_create(FT_Face face, int pxsize)
 {
-  unsigned g, glyph_count;
+  hbz_font_t *font;
 
-  hb_font_t *hb_ft_font;
-  hb_buffer_t *hb_buf;
-  hb_glyph_info_t *hb_glyph_infos;
-  hb_glyph_position_t *hb_glyph_positions;
+  font = (hbz_font_t *)malloc(sizeof(hbz_font_t));
+  if (! font)
+  {
+    font_specimen_error("harfbuzz: out of memory");
+    return NULL;
+  }
 
-  hb_ft_font = hb_ft_font_create(face, NULL);
-  hb_buf = hb_buffer_create();
+  font->font = hb_ft_font_create(face, NULL);
+  font->buffer = hb_buffer_create();
+  if (! hb_buffer_allocation_successful(font->buffer))
+  {
+    font_specimen_error("harfbuzz: can not create buffer");
+    hb_buffer_destroy(font->buffer);
+    hb_font_destroy(font->font);
+    free(font);
+    return NULL;
+  }
 
-  hb_buffer_set_direction(hb_buf, hbz_direction(dir));
-  if (script && script[0])
-    hb_buffer_set_script(hb_buf, unicode_script_tag(script));
-  if (lang[0])
-    hb_buffer_set_language(hb_buf, 
-                           hb_language_from_string(lang, strlen(lang)));
+  font->pxsize = pxsize;
+  font->nplans = 0;
+  font->next_plan = 0;
+  font->shapings = NULL;
+  font->nshapings = 0;
+  return font;
+}
 
-  hb_buffer_add_utf32(hb_buf, s, slen, 0, slen);
-  hb_shape(hb_ft_font, hb_buf, NULL, 0);
-  
-  hb_glyph_infos = hb_buffer_get_glyph_infos(hb_buf, NULL);
-  hb_glyph_positions = hb_buffer_get_glyph_positions(hb_buf, &glyph_count);
+/* pixel size of the underlying FT_Face has been changed */
+void hbz_font_set_size(hbz_font_t *font, int pxsize)
+{
+  hb_ft_font_changed(font->font);
+  font->pxsize = pxsize;
+}
 
-  if (glyph_count <= 0)
+void hbz_font_destroy(hbz_font_t *font)
+{
+  int p;
+  hbz_shaping_t *shaping, *next;
+
+  if (! font)
+    return;
+
+  for (shaping = font->shapings; shaping; shaping = next)
   {
-    font_specimen_error("harfbuzz: glyph positions couldn't be figured out");
-    return 1;
+    next = shaping->next;
+    free(shaping);
   }
+  for (p = 0; p < font->nplans; p++)
+    hb_shape_plan_destroy(font->plans[p].plan);
+  hb_buffer_destroy(font->buffer);
+  hb_font_destroy(font->font);
+  free(font);
+}
+
+/* shape plans are compiled once per face and segment properties */
+static hb_shape_plan_t *hbz_shape_plan(hbz_font_t *font,
+                                       hb_segment_properties_t *props)
+{
+  int p;
+  hbz_plan_t *slot;
+
+  for (p = 0; p < font->nplans; p++)
+    if (hb_segment_properties_equal(&font->plans[p].props, props))
+      return font->plans[p].plan;
 
-  *glyph_codepoints = malloc(glyph_count*sizeof(FT_UInt));
-  *glyph_offsets = malloc(glyph_count*sizeof(FT_Vector));
-  *glyph_advances = malloc(glyph_count*sizeof(FT_Vector));
-  if (*glyph_codepoints == NULL || 
-      *glyph_offsets == NULL || 
-      *glyph_advances == NULL)
+  if (font->nplans < HBZ_PLANS_MAX)
+    slot = &font->plans[font->nplans++];
+  else
   {
-    font_specimen_error("harfbuzz: out of memory");
-    return -1;
+    slot = &font->plans[font->next_plan];
+    font->next_plan = (font->next_plan + 1) % HBZ_PLANS_MAX;
+    hb_shape_plan_destroy(slot->plan);
+  }
+
+  slot->props = *props;
+  slot->plan = hb_shape_plan_create_cached(hb_font_get_face(font->font),
+                                           props, NULL, 0, NULL);
+  return slot->plan;
+}
+
+static uint32_t hbz_shaping_hash(uint32_t s[], int slen, int pxsize,
+                                 text_dir_t dir, uint32_t script_tag,
+                                 const char *lang)
+{
+  uint32_t h = 2166136261u; /* FNV-1a */
+  int c;
+
+  for (c = 0; c < slen; c++)
+    h = (h ^ s[c])*16777619u;
+  for (c = 0; lang[c]; c++)
+    h = (h ^ (unsigned char)lang[c])*16777619u;
+  h = (h ^ (uint32_t)pxsize)*16777619u;
+  h = (h ^ (uint32_t)dir)*16777619u;
+  h = (h ^ script_tag)*16777619u;
+  return h;
+}
+
+static hbz_shaping_t *hbz_shaping_lookup(hbz_font_t *font,
+                                         uint32_t hash,
+                                         uint32_t s[], int slen,
+                                         text_dir_t dir,
+                                         uint32_t script_tag,
+                                         const char *lang)
+{
+  hbz_shaping_t *shaping, **link;
+
+  for (link = &font->shapings; (shaping = *link); link = &shaping->next)
+  {
+    if (shaping->hash == hash &&
+        shaping->pxsize == font->pxsize &&
+        shaping->dir == dir &&
+        shaping->script_tag == script_tag &&
+        shaping->slen == slen &&
+        strcmp(shaping->lang, lang) == 0 &&
+        memcmp(shaping->text, s, slen*sizeof(uint32_t)) == 0)
+    {
+      /* move to front */
+      *link = shaping->next;
+      shaping->next = font->shapings;
+      font->shapings = shaping;
+      return shaping;
+    }
+  }
+
+  return NULL;
+}
+
+/* store current content of the harfbuzz buffer */
+static hbz_shaping_t *hbz_shaping_store(hbz_font_t *font,
+                                        uint32_t hash,
+                                        uint32_t s[], int slen,
+                                        text_dir_t dir,
+                                        uint32_t script_tag,
+                                        const char *lang)
+{
+  unsigned g, glyph_count;
+  hbz_shaping_t *shaping, **link;
+  hb_glyph_info_t *hb_glyph_infos;
+  hb_glyph_position_t *hb_glyph_positions;
+  char *block;
+
+  hb_glyph_infos = hb_buffer_get_glyph_infos(font->buffer, NULL);
+  hb_glyph_positions = hb_buffer_get_glyph_positions(font->buffer, 
+                                                     &glyph_count);
+
+  if (glyph_count <= 0)
+  {
+    font_specimen_error("harfbuzz: glyph positions couldn't be figured out");
+    return NULL;
   }
 
-  *advances_sum_x = *advances_sum_y = 0;
   for (g = 0; g < glyph_count; g++)
   {
     /* for bitmap font there can be no coverage of certain
@@ -106,19 +250,107 @@ unsigned hbz_glyphs(uint32_t s[],
     if (hb_glyph_infos[g].codepoint == 0)
     {
       font_specimen_error("harfbuzz: no size for this font and script");
-      return -1;
+      return NULL;
     }
-    (*glyph_codepoints)[g] = hb_glyph_infos[g].codepoint;
-    (*glyph_offsets)[g].x = hb_glyph_positions[g].x_offset;
-    (*glyph_offsets)[g].y = hb_glyph_positions[g].y_offset;
-    (*glyph_advances)[g].x = hb_glyph_positions[g].x_advance;
-    (*glyph_advances)[g].y = hb_glyph_positions[g].y_advance;
-    *advances_sum_x += (*glyph_advances)[g].x;
-    *advances_sum_y += (*glyph_advances)[g].y;
   }
 
-  hb_buffer_destroy(hb_buf);
-  hb_font_destroy(hb_ft_font);
-  return glyph_count;
+  /* one block for the entry, its key and the glyph arrays */
+  block = malloc(sizeof(hbz_shaping_t) + 
+                 2*glyph_count*sizeof(FT_Vector) +
+                 glyph_count*sizeof(FT_UInt) +
+                 slen*sizeof(uint32_t) +
+                 strlen(lang) + 1);
+  if (! block)
+  {
+    font_specimen_error("harfbuzz: out of memory");
+    return NULL;
+  }
+
+  shaping = (hbz_shaping_t *)block;
+  block += sizeof(hbz_shaping_t);
+  shaping->glyphs.advances = (FT_Vector *)block;
+  block += glyph_count*sizeof(FT_Vector);
+  shaping->glyphs.offsets = (FT_Vector *)block;
+  block += glyph_count*sizeof(FT_Vector);
+  shaping->glyphs.codepoints = (FT_UInt *)block;
+  block += glyph_count*sizeof(FT_UInt);
+  shaping->text = (uint32_t *)block;
+  memcpy(block, s, slen*sizeof(uint32_t));
+  block += slen*sizeof(uint32_t);
+  shaping->lang = block;
+  strcpy(block, lang);
+
+  shaping->hash = hash;
+  shaping->pxsize = font->pxsize;
+  shaping->dir = dir;
+  shaping->script_tag = script_tag;
+  shaping->slen = slen;
+
+  shaping->glyphs.nglyphs = glyph_count;
+  shaping->glyphs.sum_advances_x = shaping->glyphs.sum_advances_y = 0;
+  for (g = 0; g < glyph_count; g++)
+  {
+    shaping->glyphs.codepoints[g] = hb_glyph_infos[g].codepoint;
+    shaping->glyphs.offsets[g].x = hb_glyph_positions[g].x_offset;
+    shaping->glyphs.offsets[g].y = hb_glyph_positions[g].y_offset;
+    shaping->glyphs.advances[g].x = hb_glyph_positions[g].x_advance;
+    shaping->glyphs.advances[g].y = hb_glyph_positions[g].y_advance;
+    shaping->glyphs.sum_advances_x += shaping->glyphs.advances[g].x;
+    shaping->glyphs.sum_advances_y += shaping->glyphs.advances[g].y;
+  }
+
+  /* drop the least recently used result */
+  if (font->nshapings == HBZ_SHAPINGS_MAX)
+  {
+    for (link = &font->shapings; (*link)->next; link = &(*link)->next)
+      ;
+    free(*link);
+    *link = NULL;
+    font->nshapings--;
+  }
+
+  shaping->next = font->shapings;
+  font->shapings = shaping;
+  font->nshapings++;
+  return shaping;
 }
 
+const hbz_glyphs_t *hbz_glyphs(hbz_font_t *font,
+                               uint32_t s[], 
+                               int slen,
+                               uint32_t script_tag, 
+                               const char *lang,
+                               text_dir_t dir)
+{
+  hb_buffer_t *hb_buf = font->buffer;
+  hb_segment_properties_t props;
+  hbz_shaping_t *shaping;
+  uint32_t hash;
+
+  hash = hbz_shaping_hash(s, slen, font->pxsize, dir, script_tag, lang);
+  shaping = hbz_shaping_lookup(font, hash, s, slen, dir, script_tag, lang);
+  if (shaping)
+    return &shaping->glyphs;
+
+  hb_buffer_clear_contents(hb_buf);
+  hb_buffer_set_direction(hb_buf, hbz_direction(dir));
+  if (script_tag)
+    hb_buffer_set_script(hb_buf, script_tag);
+  if (lang[0])
+    hb_buffer_set_language(hb_buf, 
+                           hb_language_from_string(lang, strlen(lang)));
+
+  hb_buffer_add_utf32(hb_buf, s, slen, 0, slen);
+  hb_buffer_get_segment_properties(hb_buf, &props);
+  if (! hb_shape_plan_execute(hbz_shape_plan(font, &props), 
+                              font->font, hb_buf, NULL, 0))
+  {
+    font_specimen_error("harfbuzz: shaping failed");
+    return NULL;
+  }
+
+  shaping = hbz_shaping_store(font, hash, s, slen, dir, script_tag, lang);
+  if (! shaping)
+    return NULL;
+  return &shaping->glyphs;
+}
@@ -30,17 +30,32 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+/* harfbuzz font, buffer, shape plans and shaping results */
+/* kept for one FT_Face */
+typedef struct hbz_font hbz_font_t;
+
+/* shaped string */
+typedef struct
+{
+  int nglyphs;
+  FT_UInt *codepoints;
+  FT_Vector *offsets;
+  FT_Vector *advances;
+  int sum_advances_x;
+  int sum_advances_y;
+} hbz_glyphs_t;
+
 const char *hbz_version(void);
-unsigned hbz_glyphs(uint32_t s[], 
-                    int slen,
-                    const char *script, 
-                    const char *lang,
-                    text_dir_t dir, 
-                    FT_Face face,
-                    FT_UInt **glyph_codepoints,
-                    FT_Vector **glyph_offsets, 
-                    FT_Vector **glyph_advances,
-                    int *sum_advances_x,
-                    int *sum_advances_y);
+hbz_font_t *hbz_font_create(FT_Face face, int pxsize);
+void hbz_font_set_size(hbz_font_t *font, int pxsize);
+void hbz_font_destroy(hbz_font_t *font);
+/* returned glyphs are owned by font and valid */
+/* until next hbz_glyphs() call for it */
+const hbz_glyphs_t *hbz_glyphs(hbz_font_t *font,
+                               uint32_t s[], 
+                               int slen,
+                               uint32_t script_tag, 
+                               const char *lang,
+                               text_dir_t dir);
 
 #endif
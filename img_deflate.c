@@ -0,0 +1,328 @@
+/*
+ * font-specimen
+ *
+ * Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "img_deflate.h"
+#include "error.h"
+
+#define IMG_DEFLATE_WINDOW  32768
+
+/* one chunk of the input, compressed to raw deflate data */
+typedef struct
+{
+  const unsigned char *in;
+  size_t in_len;
+  const unsigned char *dict;
+  size_t dict_len;
+  int last;
+  int level;
+  int strategy;
+
+  unsigned char *out;
+  size_t out_len;
+  size_t out_size;
+  unsigned long adler;
+  int error;
+} img_deflate_chunk_t;
+
+struct img_deflate
+{
+  int threads;
+  int level;
+  int strategy;
+  img_deflate_write_t write;
+  void *closure;
+
+  /* threads chunks of input waiting for compression */
+  unsigned char *batch;
+  size_t batch_len;
+  /* end of the previous batch */
+  unsigned char dict[IMG_DEFLATE_WINDOW];
+  size_t dict_len;
+
+  img_deflate_chunk_t *chunks;
+  pthread_t *tids;
+  unsigned long adler;
+  int header_done;
+};
+
+static void *img_deflate_chunk(void *arg)
+{
+  img_deflate_chunk_t *chunk = (img_deflate_chunk_t *)arg;
+  z_stream strm;
+  size_t size;
+  unsigned char *out;
+
+  chunk->error = 1;
+  chunk->adler = adler32(adler32(0L, Z_NULL, 0), chunk->in, chunk->in_len);
+
+  memset(&strm, 0, sizeof(strm));
+  /* raw deflate: zlib header and trailer are written for the */
+  /* whole stream in img_deflate_data() and img_deflate_finish() */
+  if (deflateInit2(&strm, chunk->level, Z_DEFLATED, -15, 8, 
+                   chunk->strategy) != Z_OK)
+    return NULL;
+
+  if (chunk->dict_len && 
+      deflateSetDictionary(&strm, chunk->dict, chunk->dict_len) != Z_OK)
+  {
+    deflateEnd(&strm);
+    return NULL;
+  }
+
+  /* room for the sync flush marker too */
+  size = deflateBound(&strm, chunk->in_len) + 64;
+  if (size > chunk->out_size)
+  {
+    out = (unsigned char *)realloc(chunk->out, size);
+    if (! out)
+    {
+      deflateEnd(&strm);
+      return NULL;
+    }
+    chunk->out = out;
+    chunk->out_size = size;
+  }
+
+  strm.next_in = (unsigned char *)chunk->in;
+  strm.avail_in = chunk->in_len;
+  strm.next_out = chunk->out;
+  strm.avail_out = chunk->out_size;
+  /* sync flush ends the chunk on a byte boundary, so that */
+  /* chunks can be just concatenated */
+  if (deflate(&strm, chunk->last ? Z_FINISH : Z_SYNC_FLUSH) 
+        == (chunk->last ? Z_STREAM_END : Z_OK) &&
+      strm.avail_in == 0 && strm.avail_out > 0)
+  {
+    chunk->out_len = chunk->out_size - strm.avail_out;
+    chunk->error = 0;
+  }
+
+  deflateEnd(&strm);
+  return NULL;
+}
+
+img_deflate_t *img_deflate_create(int threads, int level, int strategy,
+                                  img_deflate_write_t write, void *closure)
+{
+  img_deflate_t *deflate;
+
+  if (threads < 1)
+    threads = 1;
+
+  deflate = (img_deflate_t *)calloc(1, sizeof(img_deflate_t));
+  if (! deflate)
+  {
+    font_specimen_error("img_deflate: not enough memory");
+    return NULL;
+  }
+
+  deflate->threads = threads;
+  deflate->level = level;
+  deflate->strategy = strategy;
+  deflate->write = write;
+  deflate->closure = closure;
+  deflate->adler = adler32(0L, Z_NULL, 0);
+
+  deflate->batch = (unsigned char *)malloc((size_t)threads*IMG_DEFLATE_CHUNK);
+  deflate->chunks 
+    = (img_deflate_chunk_t *)calloc(threads, sizeof(img_deflate_chunk_t));
+  deflate->tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  if (! deflate->batch || ! deflate->chunks || ! deflate->tids)
+  {
+    font_specimen_error("img_deflate: not enough memory");
+    img_deflate_destroy(deflate);
+    return NULL;
+  }
+
+  return deflate;
+}
+
+/* compress the batch, chunks in parallel, and write them in order */
+static int img_deflate_batch(img_deflate_t *deflate, int last)
+{
+  img_deflate_chunk_t *chunk;
+  int nchunks, c, started;
+  size_t off;
+  int ret;
+
+  nchunks = (deflate->batch_len + IMG_DEFLATE_CHUNK - 1)/IMG_DEFLATE_CHUNK;
+  /* final block has to be there even for empty input */
+  if (nchunks == 0)
+    nchunks = 1;
+
+  for (c = 0, off = 0; c < nchunks; c++, off += IMG_DEFLATE_CHUNK)
+  {
+    chunk = &deflate->chunks[c];
+    chunk->in = deflate->batch + off;
+    chunk->in_len = deflate->batch_len - off < IMG_DEFLATE_CHUNK 
+                    ? deflate->batch_len - off : IMG_DEFLATE_CHUNK;
+    if (c == 0)
+    {
+      chunk->dict = deflate->dict;
+      chunk->dict_len = deflate->dict_len;
+    }
+    else
+    {
+      /* whole chunks are longer than the window */
+      chunk->dict = chunk->in - IMG_DEFLATE_WINDOW;
+      chunk->dict_len = IMG_DEFLATE_WINDOW;
+    }
+    chunk->last = last && c == nchunks - 1;
+    chunk->level = deflate->level;
+    chunk->strategy = deflate->strategy;
+  }
+
+  /* the last chunk is done by this thread */
+  for (started = 0; started < nchunks - 1; started++)
+    if (pthread_create(&deflate->tids[started], NULL, 
+                       img_deflate_chunk, &deflate->chunks[started]))
+      break;
+  for (c = started; c < nchunks; c++)
+    img_deflate_chunk(&deflate->chunks[c]);
+  for (c = 0; c < started; c++)
+    pthread_join(deflate->tids[c], NULL);
+
+  ret = 0;
+  for (c = 0; c < nchunks; c++)
+  {
+    chunk = &deflate->chunks[c];
+    if (chunk->error)
+    {
+      font_specimen_error("img_deflate: can not compress");
+      ret = -1;
+      break;
+    }
+    deflate->adler = adler32_combine(deflate->adler, chunk->adler, 
+                                     chunk->in_len);
+    if (deflate->write(deflate->closure, chunk->out, chunk->out_len) < 0)
+    {
+      ret = -1;
+      break;
+    }
+  }
+
+  /* end of the batch is the dictionary for the next one */
+  if (deflate->batch_len >= IMG_DEFLATE_WINDOW)
+  {
+    memcpy(deflate->dict, 
+           deflate->batch + deflate->batch_len - IMG_DEFLATE_WINDOW, 
+           IMG_DEFLATE_WINDOW);
+    deflate->dict_len = IMG_DEFLATE_WINDOW;
+  }
+  else
+  {
+    /* only the last batch can be short */
+    memcpy(deflate->dict, deflate->batch, deflate->batch_len);
+    deflate->dict_len = deflate->batch_len;
+  }
+  deflate->batch_len = 0;
+
+  return ret;
+}
+
+static int img_deflate_header(img_deflate_t *deflate)
+{
+  unsigned char header[2];
+  int flevel;
+
+  if (deflate->header_done)
+    return 0;
+  deflate->header_done = 1;
+
+  /* as zlib's deflate() would write it */
+  if (deflate->level == Z_DEFAULT_COMPRESSION || deflate->level == 6)
+    flevel = 2;
+  else if (deflate->strategy >= Z_HUFFMAN_ONLY || deflate->level < 2)
+    flevel = 0;
+  else if (deflate->level < 6)
+    flevel = 1;
+  else
+    flevel = 3;
+
+  header[0] = 0x78; /* deflate, 32K window */
+  header[1] = flevel << 6;
+  header[1] += 31 - (header[0]*256 + header[1]) % 31;
+  return deflate->write(deflate->closure, header, 2);
+}
+
+int img_deflate_data(img_deflate_t *deflate, 
+                     const unsigned char *data, size_t len)
+{
+  size_t size, n;
+
+  if (img_deflate_header(deflate) < 0)
+    return -1;
+
+  size = (size_t)deflate->threads*IMG_DEFLATE_CHUNK;
+  while (len > 0)
+  {
+    n = size - deflate->batch_len;
+    if (n > len)
+      n = len;
+    memcpy(deflate->batch + deflate->batch_len, data, n);
+    deflate->batch_len += n;
+    data += n;
+    len -= n;
+
+    if (deflate->batch_len == size && img_deflate_batch(deflate, 0) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+int img_deflate_finish(img_deflate_t *deflate)
+{
+  unsigned char trailer[4];
+
+  if (img_deflate_header(deflate) < 0)
+    return -1;
+  if (img_deflate_batch(deflate, 1) < 0)
+    return -1;
+
+  trailer[0] = deflate->adler >> 24;
+  trailer[1] = deflate->adler >> 16;
+  trailer[2] = deflate->adler >> 8;
+  trailer[3] = deflate->adler;
+  return deflate->write(deflate->closure, trailer, 4);
+}
+
+void img_deflate_destroy(img_deflate_t *deflate)
+{
+  int c;
+
+  if (! deflate)
+    return;
+
+  if (deflate->chunks)
+    for (c = 0; c < deflate->threads; c++)
+      free(deflate->chunks[c].out);
+  free(deflate->chunks);
+  free(deflate->tids);
+  free(deflate->batch);
+  free(deflate);
+}
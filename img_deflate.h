@@ -0,0 +1,46 @@
+/*
+ * font-specimen
+ *
+ *  Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef IMG_DEFLATE_H
+# define IMG_DEFLATE_H
+
+# include <stddef.h>
+
+/* input is cut to chunks of this size, every chunk is compressed */
+/* by its own thread, with the end of previous chunk as dictionary */
+#define IMG_DEFLATE_CHUNK  (128*1024)
+
+/* compressed zlib stream goes to write(closure, ...) piece by piece */
+typedef int (*img_deflate_write_t)(void *closure, 
+                                   const unsigned char *data, size_t len);
+
+typedef struct img_deflate img_deflate_t;
+
+/* level and strategy are as for deflateInit2() */
+img_deflate_t *img_deflate_create(int threads, int level, int strategy,
+                                  img_deflate_write_t write, void *closure);
+int img_deflate_data(img_deflate_t *deflate, 
+                     const unsigned char *data, size_t len);
+int img_deflate_finish(img_deflate_t *deflate);
+void img_deflate_destroy(img_deflate_t *deflate);
+
+#endif
@@ -21,12 +21,19 @@
  */
 
 #include <png.h>
+#include <zlib.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "img_png.h"
+#include "img_deflate.h"
 #include "ft.h"
 #include "error.h"
 
+/* IDAT chunks of the parallel encoder are collected up to this size */
+#define IMG_PNG_IDAT_SIZE  65536
+
 char *libpng_version(char *string, int maxlen)
 {
   snprintf(string, maxlen, "%d.%d.%d", 
@@ -36,105 +43,491 @@ char *libpng_version(char *string, int maxlen)
   return string;
 }
 
-unsigned char *swapRB(unsigned char *pix_string, int len)
+struct img_png
+{
+  png_structp png_ptr;
+  png_infop info_ptr;
+  img_png_write_t write;
+  void *closure;
+  unsigned char *row;
+
+  /* gray canvas with few values is written with depth bits per */
+  /* pixel, map[] giving gray level or palette index of a value */
+  int depth;
+  unsigned char map[256];
+  unsigned char *packed;
+
+  /* parallel encoder: rows are filtered here and deflated */
+  /* by img_deflate, libpng only writes the chunks */
+  img_deflate_t *deflate;
+  int filters;        /* PNG_FILTER_* to choose from */
+  int bpp;            /* bytes per pixel */
+  size_t row_len;     /* bytes per row */
+  unsigned char *prev;   /* previous row, unfiltered */
+  unsigned char *best;   /* filter type byte and filtered row */
+  unsigned char *trial;
+  unsigned char *idat;
+  size_t idat_len;
+};
+
+static void img_png_write_data(png_structp png_ptr, 
+                               png_bytep data, png_size_t len)
+{
+  img_png_t *img = (img_png_t *)png_get_io_ptr(png_ptr);
+
+  if (img->write(img->closure, data, len) < 0)
+    png_error(png_ptr, "write failed");
+}
+
+static void img_png_flush(png_structp png_ptr)
+{
+  /* nothing is buffered here */
+}
+
+/* PNG_FILTER_* bits, 0 for default */
+static int img_png_filters(const specimen_png_options_t *options)
+{
+  int filters = 0;
+
+  if (options->filters & SPECIMEN_PNG_FILTER_NONE)
+    filters |= PNG_FILTER_NONE;
+  if (options->filters & SPECIMEN_PNG_FILTER_SUB)
+    filters |= PNG_FILTER_SUB;
+  if (options->filters & SPECIMEN_PNG_FILTER_UP)
+    filters |= PNG_FILTER_UP;
+  if (options->filters & SPECIMEN_PNG_FILTER_AVG)
+    filters |= PNG_FILTER_AVG;
+  if (options->filters & SPECIMEN_PNG_FILTER_PAETH)
+    filters |= PNG_FILTER_PAETH;
+  return filters;
+}
+
+/* Z_* strategy, -1 for default */
+static int img_png_strategy(const specimen_png_options_t *options)
 {
-  int p;
-  char tmp;
+  switch (options->strategy)
+  {
+    case SPECIMEN_PNG_STRATEGY_FILTERED:
+      return Z_FILTERED;
+    case SPECIMEN_PNG_STRATEGY_RLE:
+      return Z_RLE;
+    case SPECIMEN_PNG_STRATEGY_HUFFMAN_ONLY:
+      return Z_HUFFMAN_ONLY;
+    case SPECIMEN_PNG_STRATEGY_DEFAULT:
+    default:
+      return -1;
+  }
+}
+
+static void img_png_set_options(png_structp png_ptr,
+                                const specimen_png_options_t *options)
+{
+  if (options->level >= 0)
+    png_set_compression_level(png_ptr, 
+                              options->level < 9 ? options->level : 9);
+
+  if (options->filters)
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, img_png_filters(options));
+
+  if (img_png_strategy(options) >= 0)
+    png_set_compression_strategy(png_ptr, img_png_strategy(options));
+}
 
-  if (len % 3 != 0)
+/* lowest bit depth all possible canvas values fit in, as gray */
+/* levels (*npalette == 0) or as a palette; 8 for no reduction */
+static int img_png_reduce(img_png_t *img, const bitmap_t *bitmap,
+                          png_color palette[16], int *npalette)
+{
+  int depth, step, v, n;
+
+  *npalette = 0;
+  for (depth = 1; depth < 8; depth *= 2)
   {
-    font_specimen_error("img_png: bitmap lenght of row is not multiple of 3");
-    return NULL;
+    step = 255/((1 << depth) - 1);
+    for (v = 0; v < 256; v++)
+      if (bitmap->values[v] && v % step)
+        break;
+    if (v == 256)
+    {
+      for (v = 0; v < 256; v++)
+        img->map[v] = v/step;
+      return depth;
+    }
   }
 
-  for (p = 0; p < len; p += 3)
+  for (n = 0, v = 0; v < 256; v++)
+    if (bitmap->values[v])
+      n++;
+  if (n > 16)
+    return 8;
+
+  for (n = 0, v = 0; v < 256; v++)
   {
-    tmp = pix_string[p];
-    pix_string[p] = pix_string[p + 2];
-    pix_string[p + 2] = tmp;
+    if (! bitmap->values[v])
+      continue;
+    img->map[v] = n;
+    palette[n].red = palette[n].green = palette[n].blue = v;
+    n++;
   }
-  return pix_string;
+  *npalette = n;
+  return n <= 2 ? 1 : n <= 4 ? 2 : 4;
 }
 
-int img_png_write(FILE *png, bitmap_t bitmap)
+/* map row of width gray pixels and pack it to img->packed */
+static const unsigned char *img_png_pack(img_png_t *img, 
+                                         const unsigned char *row,
+                                         int width)
 {
-  int  i, j, png_width, png_height;
-  png_structp png_ptr;
-  png_infop info_ptr;
-  int row_len = lay_vertical(bitmap.ord) ? 3*bitmap.width : bitmap.width; 
-  unsigned char row[row_len];
-  
+  unsigned char *out = img->packed;
+  int i, k, per_byte = 8/img->depth;
+  unsigned byte;
 
-  png_width  = lay_horizontal(bitmap.ord) ? bitmap.width / 3  : bitmap.width;
-  png_height = lay_vertical(bitmap.ord)   ? bitmap.height / 3 : bitmap.height;
+  for (i = 0; i + per_byte <= width; i += per_byte)
+  {
+    byte = 0;
+    for (k = 0; k < per_byte; k++)
+      byte = (byte << img->depth) | img->map[row[i + k]];
+    *out++ = byte;
+  }
 
-  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if (png_ptr == NULL) 
+  if (i < width)
   {
-    font_specimen_error("img_png: can not create write structure");
+    byte = 0;
+    for (k = 0; k < per_byte; k++)
+      byte = (byte << img->depth) | (i + k < width ? img->map[row[i + k]] : 0);
+    *out = byte;
+  }
+  return img->packed;
+}
+
+static void img_png_write_idat(img_png_t *img)
+{
+  if (img->idat_len > 0)
+    png_write_chunk(img->png_ptr, (png_const_bytep)"IDAT", 
+                    img->idat, img->idat_len);
+  img->idat_len = 0;
+}
+
+/* compressed data from img_deflate; called within img_png_rows() */
+/* and img_png_end(), so png_error() lands in their setjmp() */
+static int img_png_idat(void *closure, const unsigned char *data, size_t len)
+{
+  img_png_t *img = (img_png_t *)closure;
+  size_t n;
+
+  /* big pieces go out as they are */
+  if (img->idat_len == 0 && len >= IMG_PNG_IDAT_SIZE)
+  {
+    png_write_chunk(img->png_ptr, (png_const_bytep)"IDAT", data, len);
+    return 0;
+  }
+
+  while (len > 0)
+  {
+    n = IMG_PNG_IDAT_SIZE - img->idat_len;
+    if (n > len)
+      n = len;
+    memcpy(img->idat + img->idat_len, data, n);
+    img->idat_len += n;
+    data += n;
+    len -= n;
+    if (img->idat_len == IMG_PNG_IDAT_SIZE)
+      img_png_write_idat(img);
+  }
+  return 0;
+}
+
+static int img_png_paeth(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+  if (pa <= pb && pa <= pc)
+    return a;
+  if (pb <= pc)
+    return b;
+  return c;
+}
+
+/* filter row to out (type byte first); return sum of absolute */
+/* values of filtered bytes, the heuristic libpng uses too, or */
+/* something over limit as soon as it is clear the sum is */
+static unsigned long img_png_filter(img_png_t *img, int type,
+                                   const unsigned char *row, 
+                                   unsigned char *out,
+                                   unsigned long limit)
+{
+  const unsigned char *prev = img->prev;
+  size_t i, len = img->row_len, bpp = img->bpp;
+  unsigned long sum = 0;
+
+  out[0] = type;
+  out++;
+  if (bpp > len)
+    bpp = len;
+
+  /* left neighbours of the first pixel are zero */
+  switch (type)
+  {
+    case 1:
+      memcpy(out, row, bpp);
+      for (i = bpp; i < len; i++)
+        out[i] = row[i] - row[i - bpp];
+      break;
+    case 2:
+      for (i = 0; i < len; i++)
+        out[i] = row[i] - prev[i];
+      break;
+    case 3:
+      for (i = 0; i < bpp; i++)
+        out[i] = row[i] - (prev[i] >> 1);
+      for (i = bpp; i < len; i++)
+        out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+      break;
+    case 4:
+      for (i = 0; i < bpp; i++)
+        out[i] = row[i] - prev[i];
+      for (i = bpp; i < len; i++)
+        out[i] = row[i] - img_png_paeth(row[i - bpp], prev[i], 
+                                        prev[i - bpp]);
+      break;
+    default:
+      memcpy(out, row, len);
+      break;
+  }
+
+  for (i = 0; i < len && sum <= limit; i++)
+    sum += out[i] < 128 ? out[i] : 256 - out[i];
+  return sum;
+}
+
+static int img_png_deflate_row(img_png_t *img, const unsigned char *row)
+{
+  const int bits[] = { PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP,
+                       PNG_FILTER_AVG, PNG_FILTER_PAETH };
+  unsigned long sum, best_sum;
+  unsigned char *tmp;
+  int type;
+
+  best_sum = ~0UL;
+  for (type = 0; type < 5; type++)
+  {
+    if (! (img->filters & bits[type]))
+      continue;
+    sum = img_png_filter(img, type, row, img->trial, best_sum);
+    if (sum < best_sum)
+    {
+      best_sum = sum;
+      tmp = img->best;
+      img->best = img->trial;
+      img->trial = tmp;
+    }
+  }
+
+  memcpy(img->prev, row, img->row_len);
+  return img_deflate_data(img->deflate, img->best, img->row_len + 1);
+}
+
+/* set up the parallel encoder, see img_png_t */
+static int img_png_parallel(img_png_t *img, 
+                            const specimen_png_options_t *options,
+                            int png_width, int channels)
+{
+  int strategy;
+
+  img->bpp = channels;
+  img->row_len = ((size_t)png_width*channels*img->depth + 7)/8;
+  /* libpng's choice: no filtering below 8 bits per pixel */
+  img->filters = options->filters 
+                   ? img_png_filters(options) 
+                   : (img->depth < 8 ? PNG_FILTER_NONE : PNG_ALL_FILTERS);
+  strategy = img_png_strategy(options);
+  if (strategy < 0)
+    strategy = img->filters == PNG_FILTER_NONE ? Z_DEFAULT_STRATEGY 
+                                               : Z_FILTERED;
+
+  img->prev = (unsigned char *)calloc(img->row_len + 1, 1);
+  img->best = (unsigned char *)malloc(img->row_len + 1);
+  img->trial = (unsigned char *)malloc(img->row_len + 1);
+  img->idat = (unsigned char *)malloc(IMG_PNG_IDAT_SIZE);
+  if (! img->prev || ! img->best || ! img->trial || ! img->idat)
+  {
+    font_specimen_error("img_png: not enough memory");
     return -1;
   }
 
-  info_ptr = png_create_info_struct(png_ptr);
-  if (info_ptr == NULL) 
+  img->deflate = img_deflate_create(options->threads,
+                                    options->level >= 0 
+                                      ? (options->level < 9 ? options->level : 9)
+                                      : Z_DEFAULT_COMPRESSION,
+                                    strategy, img_png_idat, img);
+  return img->deflate ? 0 : -1;
+}
+
+img_png_t *img_png_begin(img_png_write_t write, void *closure,
+                         const specimen_png_options_t *options,
+                         const bitmap_t *bitmap)
+{
+  int png_width, png_height, channels;
+  png_color palette[16];
+  int npalette;
+  img_png_t *img;
+
+  img = (img_png_t *)calloc(1, sizeof(img_png_t));
+  if (! img)
+  {
+    font_specimen_error("img_png: not enough memory");
+    return NULL;
+  }
+
+  img->write = write;
+  img->closure = closure;
+  ft_bitmap_image_size(bitmap, &png_width, &png_height, &channels);
+  img->depth = 8;
+  npalette = 0;
+  if (channels == 1)
+    img->depth = img_png_reduce(img, bitmap, palette, &npalette);
+
+  /* never ask for zero bytes */
+  img->row = (unsigned char *)malloc((size_t)png_width*channels + 1);
+  img->packed = (unsigned char *)malloc(((size_t)png_width + 7)/8*img->depth + 1);
+  if (! img->row || ! img->packed)
+  {
+    font_specimen_error("img_png: not enough memory");
+    img_png_destroy(img);
+    return NULL;
+  }
+
+  img->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (img->png_ptr == NULL) 
+  {
+    font_specimen_error("img_png: can not create write structure");
+    img_png_destroy(img);
+    return NULL;
+  }
+
+  img->info_ptr = png_create_info_struct(img->png_ptr);
+  if (img->info_ptr == NULL) 
   {
     font_specimen_error("img_png: can not create info structure");
-    return -1;
+    img_png_destroy(img);
+    return NULL;
   }
 
-  if (setjmp(png_jmpbuf(png_ptr))) 
+  if (setjmp(png_jmpbuf(img->png_ptr))) 
   {
     font_specimen_error("img_png: can not set png error handler");
-    return -1;
+    img_png_destroy(img);
+    return NULL;
   }
 
-  png_init_io(png_ptr, png);
+  png_set_write_fn(img->png_ptr, img, img_png_write_data, img_png_flush);
+  if (options)
+    img_png_set_options(img->png_ptr, options);
 
-  if (lay_color(bitmap.ord))
+  if (options && options->threads > 1 &&
+      img_png_parallel(img, options, png_width, channels) < 0)
   {
-    png_set_IHDR(png_ptr, info_ptr, png_width, png_height,
+    img_png_destroy(img);
+    return NULL;
+  }
+
+  if (channels == 3)
+  {
+    png_set_IHDR(img->png_ptr, img->info_ptr, png_width, png_height,
                  8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
   }
+  else if (npalette)
+  {
+    png_set_IHDR(img->png_ptr, img->info_ptr, png_width, png_height,
+                 img->depth, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_set_PLTE(img->png_ptr, img->info_ptr, palette, npalette);
+  }
   else
   {
-    png_set_IHDR(png_ptr, info_ptr, png_width, png_height,
-                 8, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+    png_set_IHDR(img->png_ptr, img->info_ptr, png_width, png_height,
+                 img->depth, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
   }
 
-  png_write_info(png_ptr, info_ptr);
-  for (j = 0; j < bitmap.height; j++)
+  png_write_info(img->png_ptr, img->info_ptr);
+  return img;
+}
+
+/* write rows of the current band of the bitmap */
+int img_png_rows(img_png_t *img, const bitmap_t *bitmap)
+{
+  int j, rows, width, height, channels;
+  const unsigned char *row;
+
+  if (setjmp(png_jmpbuf(img->png_ptr))) 
   {
-    if (lay_vertical(bitmap.ord))
-    {
-      for (i = 0; i < bitmap.width; i++)
-      {
-        row[3*i]     = bitmap.data[j    ][i];
-        row[3*i + 1] = bitmap.data[j + 1][i];
-        row[3*i + 2] = bitmap.data[j + 2][i];
-      }
-      j += 2;
-    }
-    else
-    {
-      memcpy(row, bitmap.data[j], row_len);
-    }
+    font_specimen_error("img_png: can not write rows");
+    return -1;
+  }
 
-    if (lay_bgr(bitmap.ord))
+  ft_bitmap_image_size(bitmap, &width, &height, &channels);
+  rows = ft_bitmap_image_rows(bitmap);
+  for (j = 0; j < rows; j++)
+  {
+    row = ft_bitmap_image_row(bitmap, j, img->row);
+    if (img->depth < 8)
+      row = img_png_pack(img, row, width);
+
+    if (img->deflate)
     {
-      if (swapRB(row, row_len) == NULL)
+      if (img_png_deflate_row(img, row) < 0)
         return -1;
     }
-    
-    png_write_row(png_ptr, row);
+    else
+      png_write_row(img->png_ptr, (png_bytep)row);
   }
 
-  png_write_end(png_ptr, NULL);
+  return 0;
+}
+
+int img_png_end(img_png_t *img)
+{
+  if (setjmp(png_jmpbuf(img->png_ptr))) 
+  {
+    font_specimen_error("img_png: can not finish png");
+    return -1;
+  }
 
-  png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
-  png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
+  if (img->deflate)
+  {
+    /* libpng has not seen the image data, so png_write_end() */
+    /* would refuse to finish */
+    if (img_deflate_finish(img->deflate) < 0)
+      return -1;
+    img_png_write_idat(img);
+    png_write_chunk(img->png_ptr, (png_const_bytep)"IEND", NULL, 0);
+    return 0;
+  }
 
+  png_write_end(img->png_ptr, NULL);
   return 0;
 }
 
+void img_png_destroy(img_png_t *img)
+{
+  if (! img)
+    return;
+
+  if (img->png_ptr)
+  {
+    if (img->info_ptr)
+      png_free_data(img->png_ptr, img->info_ptr, PNG_FREE_ALL, -1);
+    png_destroy_write_struct(&img->png_ptr, &img->info_ptr);
+  }
+  img_deflate_destroy(img->deflate);
+  free(img->prev);
+  free(img->best);
+  free(img->trial);
+  free(img->idat);
+  free(img->row);
+  free(img->packed);
+  free(img);
+}
@@ -20,13 +20,29 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
-#ifndef PNG_H
-# define PNG_H
+#ifndef IMG_PNG_H
+# define IMG_PNG_H
 
 # include <stdio.h>
 # include "ft.h"
+# include "specimen.h"
 
 char *libpng_version(char *string, int maxlen);
-int img_png_write(FILE *png, bitmap_t bitmap);
+/* png is written band by band: img_png_begin(), img_png_rows() */
+/* for every band of the bitmap, img_png_end(), img_png_destroy() */
+typedef struct img_png img_png_t;
+
+/* encoded bytes are passed to write(closure, ...) as they come; */
+/* it returns 0 on success */
+typedef int (*img_png_write_t)(void *closure, 
+                               const unsigned char *data, size_t len);
+
+/* options may be NULL for libpng defaults */
+img_png_t *img_png_begin(img_png_write_t write, void *closure,
+                         const specimen_png_options_t *options,
+                         const bitmap_t *bitmap);
+int img_png_rows(img_png_t *img, const bitmap_t *bitmap);
+int img_png_end(img_png_t *img);
+void img_png_destroy(img_png_t *img);
 
 #endif
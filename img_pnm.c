@@ -0,0 +1,109 @@
+/*
+ * font-specimen
+ *
+ * Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "img_pnm.h"
+#include "ft.h"
+#include "error.h"
+
+struct img_pnm
+{
+  img_pnm_write_t write;
+  void *closure;
+  size_t row_len;
+  unsigned char *row;
+};
+
+img_pnm_t *img_pnm_begin(img_pnm_write_t write, void *closure,
+                         const bitmap_t *bitmap)
+{
+  int width, height, channels;
+  char header[64];
+  img_pnm_t *img;
+
+  img = (img_pnm_t *)calloc(1, sizeof(img_pnm_t));
+  if (! img)
+  {
+    font_specimen_error("img_pnm: not enough memory");
+    return NULL;
+  }
+
+  ft_bitmap_image_size(bitmap, &width, &height, &channels);
+  img->write = write;
+  img->closure = closure;
+  img->row_len = (size_t)width*channels;
+  /* never ask for zero bytes */
+  img->row = (unsigned char *)malloc(img->row_len + 1);
+  if (! img->row)
+  {
+    font_specimen_error("img_pnm: not enough memory");
+    img_pnm_destroy(img);
+    return NULL;
+  }
+
+  snprintf(header, sizeof(header), "P%d\n%d %d\n255\n", 
+           channels == 3 ? 6 : 5, width, height);
+  if (write(closure, (const unsigned char *)header, strlen(header)) < 0)
+  {
+    font_specimen_error("img_pnm: can not write header");
+    img_pnm_destroy(img);
+    return NULL;
+  }
+  return img;
+}
+
+/* write rows of the current band of the bitmap */
+int img_pnm_rows(img_pnm_t *img, const bitmap_t *bitmap)
+{
+  int j, rows;
+
+  rows = ft_bitmap_image_rows(bitmap);
+  for (j = 0; j < rows; j++)
+  {
+    if (img->write(img->closure, 
+                   ft_bitmap_image_row(bitmap, j, img->row),
+                   img->row_len) < 0)
+    {
+      font_specimen_error("img_pnm: can not write rows");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int img_pnm_end(img_pnm_t *img)
+{
+  /* no trailer */
+  return 0;
+}
+
+void img_pnm_destroy(img_pnm_t *img)
+{
+  if (! img)
+    return;
+
+  free(img->row);
+  free(img);
+}
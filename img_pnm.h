@@ -0,0 +1,43 @@
+/*
+ * font-specimen
+ *
+ * Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef IMG_PNM_H
+# define IMG_PNM_H
+
+# include <stddef.h>
+# include "ft.h"
+
+/* binary PGM (gray) or PPM (subpixel layouts), written band */
+/* by band like img_png; rows go out as they are, so this is */
+/* the cheapest way to pass a specimen on */
+typedef struct img_pnm img_pnm_t;
+
+typedef int (*img_pnm_write_t)(void *closure, 
+                               const unsigned char *data, size_t len);
+
+img_pnm_t *img_pnm_begin(img_pnm_write_t write, void *closure,
+                         const bitmap_t *bitmap);
+int img_pnm_rows(img_pnm_t *img, const bitmap_t *bitmap);
+int img_pnm_end(img_pnm_t *img);
+void img_pnm_destroy(img_pnm_t *img);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * font-specimen
+ *
+ * Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "img_qoi.h"
+#include "ft.h"
+#include "error.h"
+
+#define IMG_QOI_OP_INDEX  0x00
+#define IMG_QOI_OP_DIFF   0x40
+#define IMG_QOI_OP_LUMA   0x80
+#define IMG_QOI_OP_RUN    0xc0
+#define IMG_QOI_OP_RGB    0xfe
+
+#define IMG_QOI_MAX_RUN   62
+
+/* pixels are opaque, alpha is always 255 */
+#define img_qoi_hash(r, g, b)  (((r)*3 + (g)*5 + (b)*7 + 255*11) % 64)
+
+struct img_qoi
+{
+  img_qoi_write_t write;
+  void *closure;
+  int width;
+  int channels;
+  unsigned char *row;
+
+  /* encoder state, kept from band to band */
+  unsigned char index[64][4]; /* recently seen pixels, RGBA */
+  unsigned char prev[3];
+  int run;
+
+  unsigned char *out; /* encoded row, at most 4 bytes a pixel */
+};
+
+static void img_qoi_put32(unsigned char *p, unsigned v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+img_qoi_t *img_qoi_begin(img_qoi_write_t write, void *closure,
+                         const bitmap_t *bitmap)
+{
+  int width, height, channels;
+  unsigned char header[14];
+  img_qoi_t *img;
+
+  img = (img_qoi_t *)calloc(1, sizeof(img_qoi_t));
+  if (! img)
+  {
+    font_specimen_error("img_qoi: not enough memory");
+    return NULL;
+  }
+
+  ft_bitmap_image_size(bitmap, &width, &height, &channels);
+  img->write = write;
+  img->closure = closure;
+  img->width = width;
+  img->channels = channels;
+  /* index starts zeroed, previous pixel is opaque black */
+  img->prev[0] = img->prev[1] = img->prev[2] = 0;
+  img->run = 0;
+
+  /* never ask for zero bytes */
+  img->row = (unsigned char *)malloc((size_t)width*channels + 1);
+  img->out = (unsigned char *)malloc((size_t)width*4 + 1);
+  if (! img->row || ! img->out)
+  {
+    font_specimen_error("img_qoi: not enough memory");
+    img_qoi_destroy(img);
+    return NULL;
+  }
+
+  memcpy(header, "qoif", 4);
+  img_qoi_put32(header + 4, width);
+  img_qoi_put32(header + 8, height);
+  header[12] = 3; /* RGB */
+  header[13] = 0; /* sRGB */
+  if (write(closure, header, sizeof(header)) < 0)
+  {
+    font_specimen_error("img_qoi: can not write header");
+    img_qoi_destroy(img);
+    return NULL;
+  }
+  return img;
+}
+
+/* encode one pixel to out, return bytes written */
+static int img_qoi_pixel(img_qoi_t *img, int r, int g, int b,
+                         unsigned char *out)
+{
+  unsigned char *p = out;
+  unsigned char *seen;
+  int dr, dg, db;
+
+  if (r == img->prev[0] && g == img->prev[1] && b == img->prev[2])
+  {
+    if (++img->run == IMG_QOI_MAX_RUN)
+    {
+      *p++ = IMG_QOI_OP_RUN | (img->run - 1);
+      img->run = 0;
+    }
+    return p - out;
+  }
+
+  if (img->run > 0)
+  {
+    *p++ = IMG_QOI_OP_RUN | (img->run - 1);
+    img->run = 0;
+  }
+
+  seen = img->index[img_qoi_hash(r, g, b)];
+  /* unused entries are transparent black */
+  if (seen[0] == r && seen[1] == g && seen[2] == b && seen[3] == 255)
+    *p++ = IMG_QOI_OP_INDEX | img_qoi_hash(r, g, b);
+  else
+  {
+    seen[0] = r;
+    seen[1] = g;
+    seen[2] = b;
+    seen[3] = 255;
+
+    dr = (signed char)(r - img->prev[0]);
+    dg = (signed char)(g - img->prev[1]);
+    db = (signed char)(b - img->prev[2]);
+    if (-2 <= dr && dr <= 1 && -2 <= dg && dg <= 1 && -2 <= db && db <= 1)
+      *p++ = IMG_QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+    else if (-32 <= dg && dg <= 31 &&
+             -8 <= dr - dg && dr - dg <= 7 &&
+             -8 <= db - dg && db - dg <= 7)
+    {
+      *p++ = IMG_QOI_OP_LUMA | (dg + 32);
+      *p++ = (dr - dg + 8) << 4 | (db - dg + 8);
+    }
+    else
+    {
+      *p++ = IMG_QOI_OP_RGB;
+      *p++ = r;
+      *p++ = g;
+      *p++ = b;
+    }
+  }
+
+  img->prev[0] = r;
+  img->prev[1] = g;
+  img->prev[2] = b;
+  return p - out;
+}
+
+/* write rows of the current band of the bitmap */
+int img_qoi_rows(img_qoi_t *img, const bitmap_t *bitmap)
+{
+  const unsigned char *row;
+  int i, j, rows;
+  size_t len;
+
+  rows = ft_bitmap_image_rows(bitmap);
+  for (j = 0; j < rows; j++)
+  {
+    row = ft_bitmap_image_row(bitmap, j, img->row);
+    len = 0;
+    if (img->channels == 3)
+      for (i = 0; i < img->width; i++)
+        len += img_qoi_pixel(img, row[3*i], row[3*i + 1], row[3*i + 2],
+                             img->out + len);
+    else
+      for (i = 0; i < img->width; i++)
+        len += img_qoi_pixel(img, row[i], row[i], row[i], img->out + len);
+
+    if (len > 0 && img->write(img->closure, img->out, len) < 0)
+    {
+      font_specimen_error("img_qoi: can not write rows");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int img_qoi_end(img_qoi_t *img)
+{
+  /* pending run, then the end marker: seven zeros and one */
+  unsigned char end[9] = { IMG_QOI_OP_RUN, 0, 0, 0, 0, 0, 0, 0, 1 };
+  unsigned char *p = end + 1;
+
+  if (img->run > 0)
+  {
+    p = end;
+    end[0] |= img->run - 1;
+    img->run = 0;
+  }
+
+  if (img->write(img->closure, p, end + sizeof(end) - p) < 0)
+  {
+    font_specimen_error("img_qoi: can not finish qoi");
+    return -1;
+  }
+  return 0;
+}
+
+void img_qoi_destroy(img_qoi_t *img)
+{
+  if (! img)
+    return;
+
+  free(img->row);
+  free(img->out);
+  free(img);
+}
@@ -0,0 +1,42 @@
+/*
+ * font-specimen
+ *
+ * Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef IMG_QOI_H
+# define IMG_QOI_H
+
+# include <stddef.h>
+# include "ft.h"
+
+/* QOI image (https://qoiformat.org), always RGB; written band */
+/* by band like img_png, in a single pass over the pixels */
+typedef struct img_qoi img_qoi_t;
+
+typedef int (*img_qoi_write_t)(void *closure, 
+                               const unsigned char *data, size_t len);
+
+img_qoi_t *img_qoi_begin(img_qoi_write_t write, void *closure,
+                         const bitmap_t *bitmap);
+int img_qoi_rows(img_qoi_t *img, const bitmap_t *bitmap);
+int img_qoi_end(img_qoi_t *img);
+void img_qoi_destroy(img_qoi_t *img);
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * font-specimen
+ *
+ * Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+#include "raster.h"
+
+/* x/100 == (x*RASTER_DIV100_MUL) >> 19 for 0 <= x <= 255*100 */
+#define RASTER_DIV100_MUL  5243
+
+void raster_gray_lut(unsigned char lut[256], int grayscale)
+{
+  int v;
+
+  /* same as ~((char)(v*grayscale/100)) applied to the pixel */
+  for (v = 0; v < 256; v++)
+    lut[v] = (unsigned char)~(v*grayscale/100);
+}
+
+/* vector part of one row; returns number of pixels done, */
+/* the rest is left to the lookup table */
+#if defined(__AVX2__)
+static int raster_blend_row_simd(unsigned char *dst,
+                                 const unsigned char *src,
+                                 int width, int grayscale)
+{
+  int i = 0;
+  __m256i s, d, lo, hi;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i gray = _mm256_set1_epi16(grayscale);
+  const __m256i div = _mm256_set1_epi16(RASTER_DIV100_MUL);
+
+  if (grayscale == 100)
+  {
+    for (; i + 32 <= width; i += 32)
+    {
+      s = _mm256_loadu_si256((const __m256i *)(src + i));
+      d = _mm256_loadu_si256((const __m256i *)(dst + i));
+      _mm256_storeu_si256((__m256i *)(dst + i), _mm256_andnot_si256(s, d));
+    }
+    return i;
+  }
+
+  for (; i + 32 <= width; i += 32)
+  {
+    s = _mm256_loadu_si256((const __m256i *)(src + i));
+    d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    /* unpack and pack both work within 128 bit lanes, */
+    /* so the byte order is preserved */
+    lo = _mm256_unpacklo_epi8(s, zero);
+    hi = _mm256_unpackhi_epi8(s, zero);
+    lo = _mm256_mullo_epi16(lo, gray);
+    hi = _mm256_mullo_epi16(hi, gray);
+    lo = _mm256_srli_epi16(_mm256_mulhi_epu16(lo, div), 3);
+    hi = _mm256_srli_epi16(_mm256_mulhi_epu16(hi, div), 3);
+    s = _mm256_packus_epi16(lo, hi);
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_andnot_si256(s, d));
+  }
+  return i;
+}
+#elif defined(__SSE2__)
+static int raster_blend_row_simd(unsigned char *dst,
+                                 const unsigned char *src,
+                                 int width, int grayscale)
+{
+  int i = 0;
+  __m128i s, d, lo, hi;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i gray = _mm_set1_epi16(grayscale);
+  const __m128i div = _mm_set1_epi16(RASTER_DIV100_MUL);
+
+  if (grayscale == 100)
+  {
+    for (; i + 16 <= width; i += 16)
+    {
+      s = _mm_loadu_si128((const __m128i *)(src + i));
+      d = _mm_loadu_si128((const __m128i *)(dst + i));
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_andnot_si128(s, d));
+    }
+    return i;
+  }
+
+  for (; i + 16 <= width; i += 16)
+  {
+    s = _mm_loadu_si128((const __m128i *)(src + i));
+    d = _mm_loadu_si128((const __m128i *)(dst + i));
+    lo = _mm_unpacklo_epi8(s, zero);
+    hi = _mm_unpackhi_epi8(s, zero);
+    lo = _mm_mullo_epi16(lo, gray);
+    hi = _mm_mullo_epi16(hi, gray);
+    lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, div), 3);
+    hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, div), 3);
+    s = _mm_packus_epi16(lo, hi);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_andnot_si128(s, d));
+  }
+  return i;
+}
+#elif defined(__ARM_NEON)
+static uint16x8_t raster_div100_neon(uint16x8_t x)
+{
+  const uint16x4_t div = vdup_n_u16(RASTER_DIV100_MUL);
+  uint32x4_t lo = vmull_u16(vget_low_u16(x), div);
+  uint32x4_t hi = vmull_u16(vget_high_u16(x), div);
+
+  return vshrq_n_u16(vcombine_u16(vshrn_n_u32(lo, 16),
+                                  vshrn_n_u32(hi, 16)), 3);
+}
+
+static int raster_blend_row_simd(unsigned char *dst,
+                                 const unsigned char *src,
+                                 int width, int grayscale)
+{
+  int i = 0;
+  uint8x16_t s, d;
+  uint16x8_t lo, hi;
+  const uint8x8_t gray = vdup_n_u8(grayscale);
+
+  if (grayscale == 100)
+  {
+    for (; i + 16 <= width; i += 16)
+    {
+      s = vld1q_u8(src + i);
+      d = vld1q_u8(dst + i);
+      vst1q_u8(dst + i, vbicq_u8(d, s));
+    }
+    return i;
+  }
+
+  for (; i + 16 <= width; i += 16)
+  {
+    s = vld1q_u8(src + i);
+    d = vld1q_u8(dst + i);
+    lo = raster_div100_neon(vmull_u8(vget_low_u8(s), gray));
+    hi = raster_div100_neon(vmull_u8(vget_high_u8(s), gray));
+    s = vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+    vst1q_u8(dst + i, vbicq_u8(d, s));
+  }
+  return i;
+}
+#else
+static int raster_blend_row_simd(unsigned char *dst,
+                                 const unsigned char *src,
+                                 int width, int grayscale)
+{
+  return 0;
+}
+#endif
+
+void raster_blend_gray(unsigned char *dst, int dst_stride,
+                       const unsigned char *src, int src_pitch,
+                       int width, int rows,
+                       int grayscale, const unsigned char lut[256])
+{
+  int p, q;
+
+  for (q = 0; q < rows; q++)
+  {
+    p = 0;
+    /* vector paths are exact only in this range */
+    if (0 <= grayscale && grayscale <= 100)
+      p = raster_blend_row_simd(dst, src, width, grayscale);
+    for (; p < width; p++)
+      dst[p] &= lut[src[p]];
+
+    dst += dst_stride;
+    src += src_pitch;
+  }
+}
+
+void raster_blend_mono(unsigned char *dst, int dst_stride,
+                       const unsigned char *src, int src_pitch,
+                       int src_bit, int width, int rows,
+                       const unsigned char lut[256])
+{
+  int p, q, b;
+  const unsigned char mask = lut[255];
+
+  for (q = 0; q < rows; q++)
+  {
+    for (p = 0, b = src_bit; p < width; p++, b++)
+      if (src[b >> 3] & (128 >> (b & 7)))
+        dst[p] &= mask;
+
+    dst += dst_stride;
+    src += src_pitch;
+  }
+}
+
+/* tile edge of the transpose; 16x16 bytes fit one cache line per row */
+/* of both source and destination and 16 SSE registers */
+#define RASTER_TILE  16
+
+#if defined(__SSE2__)
+/* one perfect shuffle of 16 rows; it rotates the (row, column) bit */
+/* index by one, so four of them make a transpose */
+#define RASTER_SHUFFLE(u, t) \
+  do \
+  { \
+    u[0]  = _mm_unpacklo_epi8(t[0], t[8]); \
+    u[1]  = _mm_unpackhi_epi8(t[0], t[8]); \
+    u[2]  = _mm_unpacklo_epi8(t[1], t[9]); \
+    u[3]  = _mm_unpackhi_epi8(t[1], t[9]); \
+    u[4]  = _mm_unpacklo_epi8(t[2], t[10]); \
+    u[5]  = _mm_unpackhi_epi8(t[2], t[10]); \
+    u[6]  = _mm_unpacklo_epi8(t[3], t[11]); \
+    u[7]  = _mm_unpackhi_epi8(t[3], t[11]); \
+    u[8]  = _mm_unpacklo_epi8(t[4], t[12]); \
+    u[9]  = _mm_unpackhi_epi8(t[4], t[12]); \
+    u[10] = _mm_unpacklo_epi8(t[5], t[13]); \
+    u[11] = _mm_unpackhi_epi8(t[5], t[13]); \
+    u[12] = _mm_unpacklo_epi8(t[6], t[14]); \
+    u[13] = _mm_unpackhi_epi8(t[6], t[14]); \
+    u[14] = _mm_unpacklo_epi8(t[7], t[15]); \
+    u[15] = _mm_unpackhi_epi8(t[7], t[15]); \
+  } while (0)
+
+static void raster_rot270_tile(unsigned char *dst, int dst_stride,
+                               const unsigned char *src, int src_stride)
+{
+  __m128i t[RASTER_TILE], u[RASTER_TILE];
+
+  /* written out, so that t[] and u[] can live in registers; */
+  /* bottom source row becomes leftmost destination column */
+#define RASTER_LOAD(i) \
+  t[i] = _mm_loadu_si128((const __m128i *) \
+                           (src + (RASTER_TILE - 1 - (i))*src_stride))
+#define RASTER_STORE(i) \
+  _mm_storeu_si128((__m128i *)(dst + (i)*dst_stride), t[i])
+
+  RASTER_LOAD(0);  RASTER_LOAD(1);  RASTER_LOAD(2);  RASTER_LOAD(3);
+  RASTER_LOAD(4);  RASTER_LOAD(5);  RASTER_LOAD(6);  RASTER_LOAD(7);
+  RASTER_LOAD(8);  RASTER_LOAD(9);  RASTER_LOAD(10); RASTER_LOAD(11);
+  RASTER_LOAD(12); RASTER_LOAD(13); RASTER_LOAD(14); RASTER_LOAD(15);
+  RASTER_SHUFFLE(u, t);
+  RASTER_SHUFFLE(t, u);
+  RASTER_SHUFFLE(u, t);
+  RASTER_SHUFFLE(t, u);
+  RASTER_STORE(0);  RASTER_STORE(1);  RASTER_STORE(2);  RASTER_STORE(3);
+  RASTER_STORE(4);  RASTER_STORE(5);  RASTER_STORE(6);  RASTER_STORE(7);
+  RASTER_STORE(8);  RASTER_STORE(9);  RASTER_STORE(10); RASTER_STORE(11);
+  RASTER_STORE(12); RASTER_STORE(13); RASTER_STORE(14); RASTER_STORE(15);
+
+#undef RASTER_LOAD
+#undef RASTER_STORE
+}
+#else
+static void raster_rot270_tile(unsigned char *dst, int dst_stride,
+                               const unsigned char *src, int src_stride)
+{
+  int row, col;
+
+  for (col = 0; col < RASTER_TILE; col++)
+    for (row = 0; row < RASTER_TILE; row++)
+      dst[col*dst_stride + RASTER_TILE - 1 - row] = src[row*src_stride + col];
+}
+#endif
+
+void raster_rot270(unsigned char *dst, int dst_stride,
+                   const unsigned char *src, int src_stride,
+                   int width, int height)
+{
+  int row, col, r, c;
+
+  /* src[row][col] goes to dst[col][height - 1 - row]; */
+  /* whole tiles first, then the ragged right and bottom edges */
+  for (row = 0; row + RASTER_TILE <= height; row += RASTER_TILE)
+    for (col = 0; col + RASTER_TILE <= width; col += RASTER_TILE)
+      raster_rot270_tile(dst + col*dst_stride + height - RASTER_TILE - row,
+                         dst_stride, src + row*src_stride + col, src_stride);
+
+  for (r = 0; r < height; r++)
+    for (c = (r < row ? width - width % RASTER_TILE : 0); c < width; c++)
+      dst[c*dst_stride + height - 1 - r] = src[r*src_stride + c];
+}
@@ -0,0 +1,48 @@
+/*
+ * font-specimen
+ *
+ *  Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RASTER_H
+# define RASTER_H
+
+/* lut[v] is the mask the canvas pixel is and-ed with */
+/* for glyph coverage v drawn with grayscale (0 to 100) */
+void raster_gray_lut(unsigned char lut[256], int grayscale);
+
+/* blend already clipped glyph area to the canvas, row by row */
+void raster_blend_gray(unsigned char *dst, int dst_stride,
+                       const unsigned char *src, int src_pitch,
+                       int width, int rows,
+                       int grayscale, const unsigned char lut[256]);
+/* src is 1 bit per pixel, first pixel is bit src_bit of src */
+void raster_blend_mono(unsigned char *dst, int dst_stride,
+                       const unsigned char *src, int src_pitch,
+                       int src_bit, int width, int rows,
+                       const unsigned char lut[256]);
+
+/* rotate width x height src by 270 degrees to height x width dst, */
+/* i. e. src[row][col] becomes dst[col][height - 1 - row]; */
+/* dst must not overlap src */
+void raster_rot270(unsigned char *dst, int dst_stride,
+                   const unsigned char *src, int src_stride,
+                   int width, int height);
+
+#endif
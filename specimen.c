@@ -20,6 +20,9 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <fontconfig/fontconfig.h>
 
 #include "specimen.h"
@@ -27,6 +30,8 @@
 #include "fc.h"
 #include "ft.h"
 #include "img_png.h"
+#include "img_pnm.h"
+#include "img_qoi.h"
 #include "error.h"
 
 #define max(a, b) ((a) > (b) ? (a) : (b))
@@ -35,6 +40,21 @@
 #define MAX_SENTENCE_LEN    50
 
 
+struct specimen_context
+{
+  FcConfig *config;
+  fontconfig_match_cache_t matches; /* fonts of requested patterns */
+  ft_context_t ft;
+  int band_height; /* 0 for whole image at once */
+  specimen_format_t format;
+  specimen_png_options_t png_options;
+  specimen_stats_t stats; /* specimen level stages, see ft.stats too */
+
+  bitmap_t canvas; /* of last specimen_render_canvas() */
+  int has_canvas;
+  unsigned char *canvas_pixels; /* when canvas had to be converted */
+};
+
 typedef struct
 {
   int x;
@@ -48,12 +68,185 @@ typedef struct
   int grayscale;
 } specimen_string_t;
 
+/* everything needed to rasterize one specimen */
+typedef struct
+{
+  FcPattern *fnt;
+  uint32_t sentence[MAX_SENTENCE_LEN]; /* referenced by strings */
+  specimen_string_t *strings;
+  int nstrings;
+  bitmap_t bitmap;
+  ft_layout_t layout; /* glyphs of all strings */
+} specimen_job_t;
+
 void specimen_set_debug(int on)
 {
   set_debug(on);
 }
 
-static int strings_waterfall(uint32_t string[],
+specimen_context_t *specimen_context_create(void)
+{
+  specimen_context_t *context;
+
+  context = (specimen_context_t *)malloc(sizeof(specimen_context_t));
+  if (! context)
+  {
+    font_specimen_error("specimen: not enough memory");
+    return NULL;
+  }
+
+  context->config = fontconfig_config_reference();
+  if (! context->config)
+  {
+    free(context);
+    return NULL;
+  }
+
+  if (ft_initialize_context(&context->ft, context->config) < 0)
+  {
+    fontconfig_config_destroy(context->config);
+    free(context);
+    return NULL;
+  }
+  fontconfig_match_cache_init(&context->matches, context->config);
+
+  context->band_height = 0;
+  context->format = SPECIMEN_FORMAT_PNG;
+  specimen_png_options_init(&context->png_options, SPECIMEN_PNG_PRESET_DEFAULT);
+  memset(&context->stats, 0, sizeof(specimen_stats_t));
+  context->has_canvas = 0;
+  context->canvas_pixels = NULL;
+  return context;
+}
+
+void specimen_context_destroy(specimen_context_t *context)
+{
+  if (! context)
+    return;
+
+  if (context->has_canvas)
+    ft_free_bitmap(&context->canvas);
+  free(context->canvas_pixels);
+  ft_free_context(&context->ft);
+  fontconfig_match_cache_free(&context->matches);
+  fontconfig_config_destroy(context->config);
+  free(context);
+}
+
+/* follow changes of fonts and configuration, once per specimen */
+static int specimen_context_update(specimen_context_t *context)
+{
+  int ret;
+
+  ret = fontconfig_config_update(&context->config);
+  if (ret > 0)
+  {
+    fontconfig_match_cache_set_config(&context->matches, context->config);
+    ft_context_set_config(&context->ft, context->config);
+  }
+  return ret < 0 ? -1 : 0;
+}
+
+void specimen_context_set_band_height(specimen_context_t *context,
+                                      int rows)
+{
+  context->band_height = rows > 0 ? rows : 0;
+}
+
+void specimen_context_set_format(specimen_context_t *context,
+                                 specimen_format_t format)
+{
+  context->format = format;
+}
+
+void specimen_png_options_init(specimen_png_options_t *options,
+                               specimen_png_preset_t preset)
+{
+  switch (preset)
+  {
+    case SPECIMEN_PNG_PRESET_FASTEST:
+      /* specimens are mostly white: unfiltered runs of white */
+      /* compress well even without searching for matches */
+      options->level = 1;
+      options->filters = SPECIMEN_PNG_FILTER_NONE;
+      options->strategy = SPECIMEN_PNG_STRATEGY_RLE;
+      options->threads = 1;
+      break;
+    case SPECIMEN_PNG_PRESET_DEFAULT:
+    default:
+      options->level = -1;
+      options->filters = 0;
+      options->strategy = SPECIMEN_PNG_STRATEGY_DEFAULT;
+      options->threads = 1;
+      break;
+  }
+}
+
+void specimen_context_set_png_options(specimen_context_t *context,
+                                      const specimen_png_options_t *options)
+{
+  context->png_options = *options;
+}
+
+void specimen_context_glyph_cache_stats(specimen_context_t *context,
+                                        unsigned long *hits,
+                                        unsigned long *misses)
+{
+  ft_glyph_cache_stats(&context->ft, hits, misses);
+}
+
+void specimen_context_set_timing(specimen_context_t *context,
+                                 int on)
+{
+  context->ft.stats.timing = on ? 1 : 0;
+}
+
+void specimen_context_stats(specimen_context_t *context,
+                            specimen_stats_t *stats)
+{
+  const ft_stats_t *ft = &context->ft.stats;
+
+  *stats = context->stats;
+  stats->shaping_ns = ft->shaping_ns;
+  stats->glyph_load_ns = ft->glyph_load_ns;
+  stats->raster_ns = ft->raster_ns;
+  stats->blend_ns = ft->blend_ns;
+  stats->rotate_ns = ft->rotate_ns;
+  stats->bytes_allocated = ft->bytes_allocated;
+  ft_glyph_cache_stats(&context->ft, &stats->glyph_cache_hits,
+                       &stats->glyph_cache_misses);
+  stats->match_cache_hits = context->matches.hits;
+  stats->match_cache_misses = context->matches.misses;
+}
+
+void specimen_context_reset_stats(specimen_context_t *context)
+{
+  int timing = context->ft.stats.timing;
+
+  memset(&context->stats, 0, sizeof(specimen_stats_t));
+  memset(&context->ft.stats, 0, sizeof(ft_stats_t));
+  context->ft.stats.timing = timing;
+  context->ft.glyphs.hits = 0;
+  context->ft.glyphs.misses = 0;
+  context->matches.hits = 0;
+  context->matches.misses = 0;
+}
+
+/* start of a measured stage, 0 when not timing */
+static uint64_t stats_start(specimen_context_t *context)
+{
+  return context->ft.stats.timing ? font_specimen_clock() : 0;
+}
+
+static void stats_stop(specimen_context_t *context, uint64_t *ns, 
+                       uint64_t start)
+{
+  if (context->ft.stats.timing)
+    *ns += font_specimen_clock() - start;
+}
+
+static int strings_waterfall(specimen_context_t *context,
+                             uint32_t string[],
                              FcPattern *pattern, 
                              const char *script,
                              const char *lang,
@@ -94,7 +287,7 @@ static int strings_waterfall(uint32_t string[],
     return -1;
   }
 
-  len = ft_text_length(string, pattern, size_to, dir, script, lang);
+  len = ft_text_length(&context->ft, string, pattern, size_to, dir, script, lang);
   if (dir < 2)
   {
     if (! *width)
@@ -153,7 +346,8 @@ static int strings_waterfall(uint32_t string[],
   return nsizes;
 }
 
-static int strings_compact(uint32_t string[],
+static int strings_compact(specimen_context_t *context,
+                             uint32_t string[],
                              FcPattern *pattern, 
                              const char *script,
                              const char *lang,
@@ -183,7 +377,7 @@ static int strings_compact(uint32_t string[],
     return -1;
   }
 
-  len = ft_text_length(string, pattern, sizes[nsizes-1], dir, script, lang);
+  len = ft_text_length(&context->ft, string, pattern, sizes[nsizes-1], dir, script, lang);
 
   if (len < 0)
     return -1;
@@ -279,27 +473,144 @@ static int strings_compact(uint32_t string[],
   return nsizes + 1;
 }
 
+static int set_string_font(bitmap_t *bitmap, specimen_string_t *string)
+{
+  return ft_bitmap_set_font(bitmap, string->pattern, string->pxsize,
+                            string->grayscale, string->dir, string->script, 
+                            string->lang);
+}
+
+/* rasterize laid out strings band by band and pass every */
+/* band to output(closure, bitmap), so that only one band */
+/* of the image is in memory */
+static int render_bands(specimen_job_t *job,
+                        int (*output)(void *closure, const bitmap_t *bitmap),
+                        void *closure)
+{
+  ft_layout_t *layout = &job->layout;
+  ft_glyph_place_t *place;
+  specimen_string_t *strings = job->strings;
+  bitmap_t *bitmap = &job->bitmap;
+  int *bin_start, *bin;
+  int nbands, band, g, i, current;
+  int ret;
+
+  ret = -1;
+  bin_start = bin = NULL;
+
+  /* glyphs of every band, in layout order: bin[bin_start[b]] */
+  /* to bin[bin_start[b + 1] - 1] */
+  nbands = bitmap->band_rows > 0 
+           ? (bitmap->height + bitmap->band_rows - 1)/bitmap->band_rows : 0;
+  bin_start = (int *)calloc(nbands + 2, sizeof(int));
+  if (! bin_start)
+  {
+    font_specimen_error("specimen: not enough memory");
+    goto done;
+  }
+  for (g = 0; g < layout->nglyphs; g++)
+  {
+    place = &layout->glyphs[g];
+    for (band = place->top/bitmap->band_rows; 
+         band <= (place->bottom - 1)/bitmap->band_rows; band++)
+      bin_start[band + 2]++;
+  }
+  for (band = 2; band < nbands + 2; band++)
+    bin_start[band] += bin_start[band - 1];
+  bin = (int *)malloc((bin_start[nbands + 1] + 1)*sizeof(int));
+  if (! bin)
+  {
+    font_specimen_error("specimen: not enough memory");
+    goto done;
+  }
+  for (g = 0; g < layout->nglyphs; g++)
+  {
+    place = &layout->glyphs[g];
+    for (band = place->top/bitmap->band_rows; 
+         band <= (place->bottom - 1)/bitmap->band_rows; band++)
+      bin[bin_start[band + 1]++] = g;
+  }
+
+  /* font of a string stays set across bands, strings that */
+  /* overlap band boundaries are not looked up again */
+  current = -1;
+  for (band = 0; band < nbands; band++)
+  {
+    ft_bitmap_band(bitmap, band*bitmap->band_rows);
+    for (i = bin_start[band]; i < bin_start[band + 1]; i++)
+    {
+      place = &layout->glyphs[bin[i]];
+      if (place->string != current)
+      {
+        current = place->string;
+        if (set_string_font(bitmap, &strings[current]) < 0)
+          goto done;
+      }
+      if (ft_draw_glyph(place, bitmap) < 0)
+        goto done;
+    }
+    if (output && output(closure, bitmap) < 0)
+      goto done;
+  }
+
+  ret = 0;
+
+done:
+  free(bin);
+  free(bin_start);
+  return ret;
+}
+
 int specimen_font_scripts(const char *font,
                           script_sort_t sort,
                           const char *scripts[],
                           double coverages[],
                           int maxscripts)
+{
+  specimen_context_t *context;
+  int ret;
+
+  if (! (context = specimen_context_create()))
+    return -1;
+  ret = specimen_font_scripts_ctx(context, font, sort, 
+                                  scripts, coverages, maxscripts);
+  specimen_context_destroy(context);
+  return ret;
+}
+
+int specimen_font_scripts_ctx(specimen_context_t *context,
+                              const char *font,
+                              script_sort_t sort,
+                              const char *scripts[],
+                              double coverages[],
+                              int maxscripts)
 {
   uinterval_stat_t *stats;
   int i, nintervals;
   FcPattern *pat, *fnt;
+  uint64_t start;
 
+  if (specimen_context_update(context) < 0)
+    return -1;
+  start = stats_start(context);
   pat = fontconfig_get_pattern(font);
   if (! pat)
     return -1;
-  fnt = fontconfig_get_font(pat);
+  fnt = fontconfig_match_cached(&context->matches, pat);
+  stats_stop(context, &context->stats.match_ns, start);
+  fontconfig_pattern_destroy(pat);
   if (! fnt)
     return -1;
 
+  start = stats_start(context);
   nintervals = unicode_interval_statistics(fnt, &stats,
                                            UI_SCRIPT, sort);
+  stats_stop(context, &context->stats.coverage_ns, start);
   if (nintervals < 0)
+  {
+    fontconfig_pattern_destroy(fnt);
     return -1;
+  }
 
   for (i = 0; i < nintervals && i < maxscripts; i++)
   {
@@ -308,34 +619,139 @@ int specimen_font_scripts(const char *font,
   }
 
   free(stats);
-  fontconfig_pattern_destroy(pat);
   fontconfig_pattern_destroy(fnt);
   return i;
 }
 
 
 int specimen_write(specimen_type_t type,
-                    const char *font,
-                    const char *script,
-                    FILE *png,
-                    int width,
-                    int height)
+                   const char *font,
+                   const char *script,
+                   FILE *png,
+                   int width,
+                   int height)
 {
-  FcPattern *pat, *fnt;
+  specimen_context_t *context;
+  int ret;
+
+  if (! (context = specimen_context_create()))
+    return -1;
+  ret = specimen_write_ctx(context, type, font, script, png, width, height);
+  specimen_context_destroy(context);
+  return ret;
+}
+
+static int write_file(void *closure, const unsigned char *data, size_t len)
+{
+  if (fwrite(data, 1, len, (FILE *)closure) != len)
+  {
+    font_specimen_error("specimen: can not write to the file");
+    return -1;
+  }
+  return 0;
+}
+
+int specimen_write_ctx(specimen_context_t *context,
+                       specimen_type_t type,
+                       const char *font,
+                       const char *script,
+                       FILE *png,
+                       int width,
+                       int height)
+{
+  return specimen_write_callback(context, type, font, script, 
+                                 write_file, png, width, height);
+}
+
+typedef struct
+{
+  unsigned char *data;
+  size_t size;
+  size_t alloc;
+} mem_buffer_t;
+
+static int write_mem(void *closure, const unsigned char *data, size_t len)
+{
+  mem_buffer_t *mem = (mem_buffer_t *)closure;
+  unsigned char *grown;
+  size_t alloc;
+
+  if (mem->size + len > mem->alloc)
+  {
+    alloc = mem->alloc ? mem->alloc : 4096;
+    while (alloc < mem->size + len)
+      alloc *= 2;
+    grown = (unsigned char *)realloc(mem->data, alloc);
+    if (! grown)
+    {
+      font_specimen_error("specimen: not enough memory");
+      return -1;
+    }
+    mem->data = grown;
+    mem->alloc = alloc;
+  }
+
+  memcpy(mem->data + mem->size, data, len);
+  mem->size += len;
+  return 0;
+}
+
+int specimen_write_mem(specimen_context_t *context,
+                       specimen_type_t type,
+                       const char *font,
+                       const char *script,
+                       unsigned char **png,
+                       size_t *size,
+                       int width,
+                       int height)
+{
+  mem_buffer_t mem = { NULL, 0, 0 };
+
+  if (specimen_write_callback(context, type, font, script, 
+                              write_mem, &mem, width, height) < 0)
+  {
+    free(mem.data);
+    return -1;
+  }
+
+  *png = mem.data;
+  *size = mem.size;
+  return 0;
+}
+
+static void specimen_job_free(specimen_job_t *job)
+{
+  ft_free_layout(&job->layout);
+  ft_free_bitmap(&job->bitmap);
+  free(job->strings);
+  fontconfig_pattern_destroy(job->fnt);
+}
+
+/* choose sentence, initialize the bitmap and lay out strings */
+static int specimen_prepare(specimen_context_t *context,
+                            specimen_type_t type,
+                            const char *font,
+                            const char *script,
+                            int width,
+                            int height,
+                            int band,
+                            specimen_job_t *job)
+{
+  FcPattern *pat, *match, *fnt;
   text_dir_t dir;
   img_transform_t transform;
   const char *lang;
   int random;
-  uint32_t sentence[MAX_SENTENCE_LEN];
+  uint32_t *sentence = job->sentence;
   int nstrings;
   int tmp;
 
-  bitmap_t bitmap;
   int ord, lcdfilter;
-  int t;
   specimen_string_t *strings;
+  int has_bitmap;
 
   int o, value;
+  uint64_t start;
   const char *rendering_options_bool[] = { FC_ANTIALIAS, 
                                            FC_HINTING, 
                                            FC_AUTOHINT, 
@@ -346,12 +762,36 @@ int specimen_write(specimen_type_t type,
                                            FC_EMBEDDED_BITMAP,
                                            NULL };
 
+  /* on failure everything is released at fail, the context lives on */
+  fnt = NULL;
+  strings = NULL;
+  has_bitmap = 0;
+  job->layout.glyphs = NULL;
+  job->layout.nglyphs = 0;
+  job->layout.maxglyphs = 0;
+
+  if (specimen_context_update(context) < 0)
+    return -1;
+
+  start = stats_start(context);
   pat = fontconfig_get_pattern(font);
   if (! pat)
     return -1;
-  fnt = fontconfig_get_font(pat);
+  match = fontconfig_match_cached(&context->matches, pat);
+  if (! match)
+  {
+    fontconfig_pattern_destroy(pat);
+    return -1;
+  }
+  /* cached match is shared, options below go to own copy */
+  fnt = fontconfig_pattern_duplicate(match);
+  fontconfig_pattern_destroy(match);
+  stats_stop(context, &context->stats.match_ns, start);
   if (! fnt)
+  {
+    fontconfig_pattern_destroy(pat);
     return -1;
+  }
 
   /* set requested rendering options which are lost 
      via current system's fontconfig */
@@ -372,34 +812,36 @@ int specimen_write(specimen_type_t type,
   }
   fontconfig_pattern_destroy(pat);
 
+  start = stats_start(context);
   if (unicode_specimen_sentence(fnt, NULL, script, MAX_SENTENCE_LEN,
                                 &dir, &transform, &lang,
                                 &random, sentence) < 0)
-    return -1;
+    goto fail;
+  stats_stop(context, &context->stats.sentence_ns, start);
   if (random == 2)
   {
     font_specimen_error("specimen: no symbols for this font and script");
-    return -1;
+    goto fail;
   }
 
   switch (type)
   {
     case SPECIMEN_WATERFALL:
-      nstrings = strings_waterfall(sentence, fnt, script,
+      nstrings = strings_waterfall(context, sentence, fnt, script,
                                    lang, dir, &strings,
                                    &width, &height);      
       if (nstrings < 0)
-        return -1;
+        goto fail;
       break;
     case SPECIMEN_COMPACT: 
-      nstrings = strings_compact(sentence, fnt, script,
+      nstrings = strings_compact(context, sentence, fnt, script,
                                  lang, dir, &strings,
                                  &width, &height); 
       if (nstrings < 0)
-        return -1;
+        goto fail;
       break;
     default:
-      return -1;
+      goto fail;
   }
 
   switch (transform)
@@ -412,7 +854,7 @@ int specimen_write(specimen_type_t type,
     case TRNS_NONE:
       break;
     default:
-      return -1;
+      goto fail;
   }
 
   if (fontconfig_pattern_get_integer(fnt, FC_RGBA, &ord) < 0)
@@ -422,38 +864,346 @@ int specimen_write(specimen_type_t type,
 
   lcdfilter = (lcdfilter != 3 ? lcdfilter : 16);
 
-  if (ft_initialize_bitmap(&bitmap, height, width, ord, lcdfilter) < 0)
-    return -1;
+  /* vertical scripts are drawn rotated right away */
+  if (ft_initialize_bitmap(&job->bitmap, &context->ft, 
+                           height, width, ord, lcdfilter,
+                           transform == TRNS_ROT270, band) < 0)
+    goto fail;
+  has_bitmap = 1;
 
-  for (t = 0; t < nstrings; t++)
+  job->fnt = fnt;
+  job->strings = strings;
+  job->nstrings = nstrings;
+
+  /* glyphs are rendered here already, which also tells */
+  /* which values the canvas can hold */
+  for (o = 0; o < nstrings; o++)
   {
-    if (ft_bitmap_set_font(&bitmap, strings[t].pattern, strings[t].pxsize,
-                           strings[t].grayscale, strings[t].dir, strings[t].script, 
-                           strings[t].lang) < 0)
-      return -1;
-    if (ft_draw_text(strings[t].sentence, strings[t].x, 
-                     strings[t].y, &bitmap) < 0)
-      return -1;
+    if (set_string_font(&job->bitmap, &strings[o]) < 0 ||
+        ft_layout_text(strings[o].sentence, strings[o].x, strings[o].y,
+                       &job->bitmap, o, &job->layout) < 0)
+      goto fail;
   }
+  context->stats.glyphs += job->layout.nglyphs;
+  return 0;
 
-  switch (transform)
+fail:
+  ft_free_layout(&job->layout);
+  if (has_bitmap)
+    ft_free_bitmap(&job->bitmap);
+  free(strings);
+  fontconfig_pattern_destroy(fnt);
+  return -1;
+}
+
+/* encoder of one of the formats, they share the band interface */
+typedef struct
+{
+  specimen_format_t format;
+  img_png_t *png;
+  img_pnm_t *pnm;
+  img_qoi_t *qoi;
+  specimen_context_t *context; /* for stats */
+  specimen_write_fn_t write;   /* of the caller */
+  void *closure;
+} encoder_t;
+
+/* counts bytes on their way to the caller's write() */
+static int encoder_write(void *closure, 
+                         const unsigned char *data, size_t len)
+{
+  encoder_t *enc = (encoder_t *)closure;
+
+  enc->context->stats.bytes_written += len;
+  return enc->write(enc->closure, data, len);
+}
+
+static int encoder_begin(encoder_t *enc, specimen_context_t *context,
+                         specimen_write_fn_t write, void *closure,
+                         const bitmap_t *bitmap)
+{
+  uint64_t start;
+  int ret;
+
+  enc->format = context->format;
+  enc->png = NULL;
+  enc->pnm = NULL;
+  enc->qoi = NULL;
+  enc->context = context;
+  enc->write = write;
+  enc->closure = closure;
+
+  start = stats_start(context);
+  switch (enc->format)
   {
-    case TRNS_ROT270:
-      ft_rot270(&bitmap);
+    case SPECIMEN_FORMAT_PNM:
+      enc->pnm = img_pnm_begin(encoder_write, enc, bitmap);
+      ret = enc->pnm ? 0 : -1;
       break;
-    case TRNS_NONE:
+    case SPECIMEN_FORMAT_QOI:
+      enc->qoi = img_qoi_begin(encoder_write, enc, bitmap);
+      ret = enc->qoi ? 0 : -1;
       break;
+    case SPECIMEN_FORMAT_PNG:
     default:
+      enc->png = img_png_begin(encoder_write, enc, 
+                               &context->png_options, bitmap);
+      ret = enc->png ? 0 : -1;
+      break;
+  }
+  stats_stop(context, &context->stats.encode_ns, start);
+  return ret;
+}
+
+static int output_encoder(void *closure, const bitmap_t *bitmap)
+{
+  encoder_t *enc = (encoder_t *)closure;
+  uint64_t start;
+  int ret;
+
+  start = stats_start(enc->context);
+  if (enc->pnm)
+    ret = img_pnm_rows(enc->pnm, bitmap);
+  else if (enc->qoi)
+    ret = img_qoi_rows(enc->qoi, bitmap);
+  else
+    ret = img_png_rows(enc->png, bitmap);
+  stats_stop(enc->context, &enc->context->stats.encode_ns, start);
+  return ret;
+}
+
+static int encoder_end(encoder_t *enc)
+{
+  uint64_t start;
+  int ret;
+
+  start = stats_start(enc->context);
+  if (enc->pnm)
+    ret = img_pnm_end(enc->pnm);
+  else if (enc->qoi)
+    ret = img_qoi_end(enc->qoi);
+  else
+    ret = img_png_end(enc->png);
+  stats_stop(enc->context, &enc->context->stats.encode_ns, start);
+  return ret;
+}
+
+static void encoder_destroy(encoder_t *enc)
+{
+  img_pnm_destroy(enc->pnm);
+  img_qoi_destroy(enc->qoi);
+  img_png_destroy(enc->png);
+}
+
+int specimen_write_callback(specimen_context_t *context,
+                            specimen_type_t type,
+                            const char *font,
+                            const char *script,
+                            specimen_write_fn_t write,
+                            void *closure,
+                            int width,
+                            int height)
+{
+  specimen_job_t job;
+  encoder_t enc;
+  int ret;
+
+  if (! context)
+  {
+    if (! (context = specimen_context_create()))
       return -1;
+    ret = specimen_write_callback(context, type, font, script, 
+                                  write, closure, width, height);
+    specimen_context_destroy(context);
+    return ret;
   }
 
-  if (img_png_write(png, bitmap) < 0)
+  if (specimen_prepare(context, type, font, script, width, height,
+                       context->band_height, &job) < 0)
     return -1;
 
-  ft_free_bitmap(&bitmap);
-  free(strings);
-  fontconfig_pattern_destroy(fnt);
+  ret = -1;
+  if (encoder_begin(&enc, context, write, closure, &job.bitmap) == 0 &&
+      render_bands(&job, output_encoder, &enc) == 0 &&
+      encoder_end(&enc) == 0)
+    ret = 0;
+
+  encoder_destroy(&enc);
+  specimen_job_free(&job);
+  return ret;
+}
+
+typedef struct
+{
+  unsigned char *pixels;
+  int stride;
+  specimen_pixel_format_t format;
+  unsigned char *row; /* image row when it needs conversion */
+} pixels_output_t;
+
+static int output_pixels(void *closure, const bitmap_t *bitmap)
+{
+  pixels_output_t *out = (pixels_output_t *)closure;
+  int width, height, channels;
+  int row, first, rows, i;
+  unsigned char *dst;
+  const unsigned char *src;
+
+  ft_bitmap_image_size(bitmap, &width, &height, &channels);
+  first = lay_vertical(bitmap->ord) ? bitmap->band_top / 3 
+                                    : bitmap->band_top;
+  rows = ft_bitmap_image_rows(bitmap);
+  for (row = 0; row < rows; row++)
+  {
+    dst = out->pixels + (size_t)(first + row)*out->stride;
+    if (channels == 1 && out->format == SPECIMEN_PIXEL_RGB24)
+    {
+      src = ft_bitmap_image_row(bitmap, row, out->row);
+      for (i = 0; i < width; i++)
+        dst[3*i] = dst[3*i + 1] = dst[3*i + 2] = src[i];
+    }
+    else
+    {
+      src = ft_bitmap_image_row(bitmap, row, dst);
+      if (src != dst)
+        memcpy(dst, src, (size_t)width*channels);
+    }
+  }
+  return 0;
+}
+
+int specimen_render_pixels(specimen_context_t *context,
+                           specimen_type_t type,
+                           const char *font,
+                           const char *script,
+                           unsigned char *pixels,
+                           int width,
+                           int height,
+                           int stride,
+                           specimen_pixel_format_t format)
+{
+  specimen_job_t job;
+  pixels_output_t out;
+  int image_width, image_height, channels;
+  int ret;
+
+  if (! context)
+  {
+    if (! (context = specimen_context_create()))
+      return -1;
+    ret = specimen_render_pixels(context, type, font, script, 
+                                 pixels, width, height, stride, format);
+    specimen_context_destroy(context);
+    return ret;
+  }
+
+  if (width <= 0 || height <= 0 || 
+      stride < width*(format == SPECIMEN_PIXEL_RGB24 ? 3 : 1))
+  {
+    font_specimen_error("specimen: wrong pixel buffer dimensions");
+    return -1;
+  }
+
+  if (specimen_prepare(context, type, font, script, width, height,
+                       context->band_height, &job) < 0)
+    return -1;
+
+  ret = -1;
+  out.pixels = pixels;
+  out.stride = stride;
+  out.format = format;
+  out.row = NULL;
+
+  ft_bitmap_image_size(&job.bitmap, &image_width, &image_height, &channels);
+  if (image_width > width || image_height > height)
+    font_specimen_error("specimen: image does not fit the pixel buffer");
+  else if (channels == 3 && format != SPECIMEN_PIXEL_RGB24)
+    font_specimen_error("specimen: subpixel rendering needs RGB24 pixels");
+  else if (! (out.row = (unsigned char *)malloc(image_width + 1)))
+    font_specimen_error("specimen: not enough memory");
+  else if (render_bands(&job, output_pixels, &out) == 0)
+    ret = 0;
+
+  free(out.row);
+  specimen_job_free(&job);
+  return ret;
+}
+
+int specimen_render_canvas(specimen_context_t *context,
+                           specimen_type_t type,
+                           const char *font,
+                           const char *script,
+                           int width,
+                           int height,
+                           specimen_canvas_t *canvas)
+{
+  specimen_job_t job;
+  bitmap_t *bitmap;
+  int row, channels;
+
+  /* canvas is owned by the context, a temporary one would free it */
+  if (! context)
+  {
+    font_specimen_error("specimen: canvas needs a context");
+    return -1;
+  }
+
+  if (context->has_canvas)
+  {
+    ft_free_bitmap(&context->canvas);
+    context->has_canvas = 0;
+  }
+  free(context->canvas_pixels);
+  context->canvas_pixels = NULL;
+
+  /* whole canvas, regardless of band height */
+  if (specimen_prepare(context, type, font, script, width, height,
+                       0, &job) < 0)
+    return -1;
+
+  if (render_bands(&job, NULL, NULL) < 0)
+  {
+    specimen_job_free(&job);
+    return -1;
+  }
+
+  /* keep the bitmap, drop the rest */
+  context->canvas = job.bitmap;
+  context->has_canvas = 1;
+  job.bitmap.buffer = NULL;
+  job.bitmap.data = NULL;
+  job.bitmap.scratch = NULL;
+  specimen_job_free(&job);
+
+  bitmap = &context->canvas;
+  ft_bitmap_image_size(bitmap, &canvas->width, &canvas->height, &channels);
+  canvas->format = channels == 3 ? SPECIMEN_PIXEL_RGB24 
+                                 : SPECIMEN_PIXEL_GRAY8;
+
+  if (lay_vertical(bitmap->ord))
+  {
+    /* subpixel rows have to be interleaved to new pixels */
+    canvas->stride = 3*canvas->width;
+    context->canvas_pixels 
+      = (unsigned char *)malloc((size_t)canvas->stride*canvas->height + 1);
+    if (! context->canvas_pixels)
+    {
+      font_specimen_error("specimen: not enough memory");
+      return -1;
+    }
+    for (row = 0; row < canvas->height; row++)
+      ft_bitmap_image_row(bitmap, row, 
+                          context->canvas_pixels + (size_t)row*canvas->stride);
+    canvas->pixels = context->canvas_pixels;
+    return 0;
+  }
 
+  /* in place; only swaps subpixels for BGR */
+  if (lay_bgr(bitmap->ord))
+    for (row = 0; row < canvas->height; row++)
+      ft_bitmap_image_row(bitmap, row, bitmap->data[row]);
+  canvas->stride = bitmap->stride;
+  canvas->pixels = bitmap->buffer;
   return 0;
 }
 
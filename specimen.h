@@ -24,6 +24,7 @@
 # define SPECIMEN_H
 
 #include <stdio.h>
+#include <stdint.h>
 
 typedef enum
 {
@@ -38,6 +39,76 @@ typedef enum
   SCRIPT_SORT_PERCENT
 } script_sort_t;
 
+/* image format written by specimen_write*() */
+typedef enum
+{
+  SPECIMEN_FORMAT_PNG, /* default */
+  SPECIMEN_FORMAT_PNM, /* binary PGM, PPM for subpixel layouts */
+  SPECIMEN_FORMAT_QOI  /* QOI, RGB */
+} specimen_format_t;
+
+/* png row filters, can be or-ed */
+#define SPECIMEN_PNG_FILTER_NONE   0x01
+#define SPECIMEN_PNG_FILTER_SUB    0x02
+#define SPECIMEN_PNG_FILTER_UP     0x04
+#define SPECIMEN_PNG_FILTER_AVG    0x08
+#define SPECIMEN_PNG_FILTER_PAETH  0x10
+#define SPECIMEN_PNG_FILTER_ALL    0x1f
+
+typedef enum
+{
+  SPECIMEN_PNG_STRATEGY_DEFAULT, /* as libpng chooses */
+  SPECIMEN_PNG_STRATEGY_FILTERED,
+  SPECIMEN_PNG_STRATEGY_RLE,
+  SPECIMEN_PNG_STRATEGY_HUFFMAN_ONLY
+} specimen_png_strategy_t;
+
+typedef enum
+{
+  SPECIMEN_PNG_PRESET_DEFAULT,  /* libpng defaults */
+  SPECIMEN_PNG_PRESET_FASTEST   /* fast encoding, slightly bigger files */
+} specimen_png_preset_t;
+
+typedef struct
+{
+  int level;   /* zlib level 0 to 9, -1 for default */
+  int filters; /* SPECIMEN_PNG_FILTER_*, 0 for default */
+  specimen_png_strategy_t strategy;
+  int threads; /* > 1 deflates chunks of the image in parallel */
+} specimen_png_options_t;
+
+/* where time and memory of specimens went, summed since the context */
+/* was created or reset; times in nanoseconds are only taken after */
+/* specimen_context_set_timing(context, 1), the counters always; */
+/* stats belong to a context, specimen_write() and the functions */
+/* given a NULL context drop them with their temporary context, */
+/* so pass a context to get them */
+typedef struct
+{
+  uint64_t match_ns;      /* fontconfig pattern parsing and matching */
+  uint64_t coverage_ns;   /* script coverage of specimen_font_scripts*() */
+  uint64_t sentence_ns;   /* choosing the sentence */
+  uint64_t shaping_ns;
+  uint64_t glyph_load_ns; /* loading outlines, glyph cache misses only */
+  uint64_t raster_ns;     /* rendering glyphs to bitmaps */
+  uint64_t blend_ns;      /* drawing glyph bitmaps onto the canvas */
+  uint64_t rotate_ns;     /* rotating glyphs of vertical scripts */
+  uint64_t encode_ns;     /* image encoding including writes */
+  unsigned long glyphs;   /* placed glyphs */
+  unsigned long glyph_cache_hits;
+  unsigned long glyph_cache_misses;
+  unsigned long match_cache_hits;
+  unsigned long match_cache_misses;
+  uint64_t bytes_allocated; /* canvases, glyph cache, layouts, scratch */
+  uint64_t bytes_written;   /* encoded image bytes */
+} specimen_stats_t;
+
+/* holds libraries and caches that can be reused between specimens */
+typedef struct specimen_context specimen_context_t;
+
+extern specimen_context_t *specimen_context_create(void);
+extern void specimen_context_destroy(specimen_context_t *context);
+
 /* width = 0 => width automatic, height = 0 => height automatic */
 extern int specimen_write(specimen_type_t type,
                           const char *font,
@@ -50,6 +121,104 @@ extern int specimen_font_scripts(const char *font,
                                  const char *scripts[],
                                  double coverages[],
                                  int maxscripts);
+extern int specimen_write_ctx(specimen_context_t *context,
+                              specimen_type_t type,
+                              const char *font,
+                              const char *script,
+                              FILE *png,
+                              int width,
+                              int height);
+
+/* encoded image bytes are passed to write(closure, ...) as they are */
+/* produced; it returns 0 on success, -1 aborts the specimen */
+typedef int (*specimen_write_fn_t)(void *closure, 
+                                   const unsigned char *data, size_t len);
+
+/* context may be NULL in both: a temporary one is used then */
+extern int specimen_write_callback(specimen_context_t *context,
+                                   specimen_type_t type,
+                                   const char *font,
+                                   const char *script,
+                                   specimen_write_fn_t write,
+                                   void *closure,
+                                   int width,
+                                   int height);
+/* *png is allocated with malloc() and owned by the caller */
+extern int specimen_write_mem(specimen_context_t *context,
+                              specimen_type_t type,
+                              const char *font,
+                              const char *script,
+                              unsigned char **png,
+                              size_t *size,
+                              int width,
+                              int height);
+
+typedef enum
+{
+  SPECIMEN_PIXEL_GRAY8, /* one byte per pixel */
+  SPECIMEN_PIXEL_RGB24  /* three bytes per pixel, R, G, B */
+} specimen_pixel_format_t;
+
+/* render without encoding into caller's pixels, stride bytes per row; */
+/* width and height must be given, gray specimens can be rendered to */
+/* RGB24, subpixel ones (rgba pattern property) only to RGB24 */
+extern int specimen_render_pixels(specimen_context_t *context,
+                                  specimen_type_t type,
+                                  const char *font,
+                                  const char *script,
+                                  unsigned char *pixels,
+                                  int width,
+                                  int height,
+                                  int stride,
+                                  specimen_pixel_format_t format);
+
+typedef struct
+{
+  const unsigned char *pixels;
+  int width;
+  int height;
+  int stride;
+  specimen_pixel_format_t format;
+} specimen_canvas_t;
+
+/* render into the context's own canvas and describe it in *canvas; */
+/* pixels are not copied (except for vertical subpixel layouts) and */
+/* stay valid until the next call or specimen_context_destroy(); */
+/* fails with NULL context */
+extern int specimen_render_canvas(specimen_context_t *context,
+                                  specimen_type_t type,
+                                  const char *font,
+                                  const char *script,
+                                  int width,
+                                  int height,
+                                  specimen_canvas_t *canvas);
+extern int specimen_font_scripts_ctx(specimen_context_t *context,
+                                     const char *font,
+                                     script_sort_t sort,
+                                     const char *scripts[],
+                                     double coverages[],
+                                     int maxscripts);
+/* render and write images in bands of at most rows pixel rows, */
+/* which bounds memory for big images; 0 (default) for whole image */
+extern void specimen_context_set_band_height(specimen_context_t *context,
+                                             int rows);
+/* format of images written with the context */
+extern void specimen_context_set_format(specimen_context_t *context,
+                                        specimen_format_t format);
+/* fill options with a preset, to be used as they are or adjusted */
+extern void specimen_png_options_init(specimen_png_options_t *options,
+                                      specimen_png_preset_t preset);
+extern void specimen_context_set_png_options(specimen_context_t *context,
+                                             const specimen_png_options_t *options);
+extern void specimen_context_glyph_cache_stats(specimen_context_t *context,
+                                               unsigned long *hits,
+                                               unsigned long *misses);
+/* take per-stage times from now on (on = 1) or stop (on = 0) */
+extern void specimen_context_set_timing(specimen_context_t *context,
+                                        int on);
+extern void specimen_context_stats(specimen_context_t *context,
+                                   specimen_stats_t *stats);
+extern void specimen_context_reset_stats(specimen_context_t *context);
 extern void specimen_set_debug(int on);
 
 #endif
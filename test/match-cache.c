@@ -0,0 +1,58 @@
+/*
+ * font-specimen
+ *
+ * Display Font Specimen
+ *
+ * Copyright (C) 2014 Petr Gajdos (pgajdos at suse)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* a repeated request is answered from the match cache */
+
+#include <stdio.h>
+
+#include "../specimen.h"
+
+#define MAXSCRIPTS  20
+
+int main(void)
+{
+  specimen_context_t *context;
+  specimen_stats_t stats;
+  const char *scripts[MAXSCRIPTS];
+  double coverages[MAXSCRIPTS];
+  int i, ret;
+
+  if (! (context = specimen_context_create()))
+    return 1;
+
+  ret = 0;
+  for (i = 0; i < 2; i++)
+    if (specimen_font_scripts_ctx(context, "sans", SCRIPT_SORT_PERCENT,
+                                  scripts, coverages, MAXSCRIPTS) < 0)
+      ret = 1;
+
+  specimen_context_stats(context, &stats);
+  if (ret == 0 && (stats.match_cache_hits != 1
+                   || stats.match_cache_misses != 1))
+    ret = 1;
+  printf("match-cache: %lu hits, %lu misses: %s\n",
+         stats.match_cache_hits, stats.match_cache_misses,
+         ret ? "FAIL" : "ok");
+
+  specimen_context_destroy(context);
+  return ret;
+}
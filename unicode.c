@@ -27,6 +27,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 typedef struct
 { 
@@ -41,6 +42,12 @@ typedef struct
   const char *interval_name;
 } uinterval_map_t;
 
+typedef struct
+{
+  const char *name;
+  int id;
+} uinterval_name_t;
+
 static const script_t script_consts[] =
 {
   #include "unicode/scripts.txt"
@@ -56,6 +63,10 @@ static const uinterval_map_t block_map_consts[] =
   #include "unicode/blocks-map.txt"
 };
 
+/* ids of map entries and codepoint to id tables, see table.sh */
+#include "unicode/scripts-table.txt"
+#include "unicode/blocks-table.txt"
+
 
 #define SCRIPT_SENTENCE_LEN_MIN   4
 
@@ -72,6 +83,15 @@ static const uinterval_map_t block_map_consts[] =
 #define uinterval_name(index, uintype) \
   (uintype == UI_SCRIPT ? script_consts[index].name \
                      : block_map_consts[index].interval_name)
+#define uinterval_map_ids(uintype) \
+  (uintype == UI_SCRIPT ? script_map_ids : block_map_ids)
+/* id + 1 of the interval owning ch < 0x110000, 0 for none */
+#define uinterval_table(uintype, ch) \
+  (uintype == UI_SCRIPT \
+     ? script_ids[script_pages[(ch) >> 8] << 8 | ((ch) & 0xff)] \
+     : block_ids[block_pages[(ch) >> 8] << 8 | ((ch) & 0xff)])
+#define UNICODE_MAX_CHAR  0x10FFFF
+#define UNICODE_NUM_PAGES (((UNICODE_MAX_CHAR) >> 8) + 1)
 
 typedef struct
 {
@@ -79,6 +99,16 @@ typedef struct
   const char *lang;
 } sentence_t;
 
+/* sentence decoded at build time, see ucs4.sh */
+typedef struct
+{
+  int chars;  /* offset to sentence_chars[] */
+  int len;
+  int pages;  /* offset to sentence_pages[] */
+  int npages;
+  const char *lang;
+} sentence_ucs4_t;
+
 #define TAG(c1,c2,c3,c4) ((uint32_t)((((uint8_t)(c1))<<24)|(((uint8_t)(c2))<<16)|(((uint8_t)(c3))<<8)|((uint8_t)(c4))))
 
 typedef struct
@@ -96,33 +126,194 @@ static const script_data_t script_data_consts[] =
   #include "unicode/sentences.txt"
 };
 
-double unicode_interval_coverage(FcPattern *pattern,
-                                 const char *uinname,
-                                 uinterval_type_t uintype,
-                                 uint32_t *ch_success,
-                                 uint32_t *ui_size)
+#include "unicode/sentences-ucs4.txt"
+
+/* sorted names, script ids to script_data_consts, see registry.sh */
+#include "unicode/scripts-registry.txt"
+#include "unicode/blocks-registry.txt"
+
+static int unicode_name_compare(const void *name, const void *entry)
 {
-  int m;
-  uint32_t c;
-  uint32_t uinterval_size, charset_success;
+  return strcmp((const char *)name, ((const uinterval_name_t *)entry)->name);
+}
 
-  FcCharSet *charset;
+int unicode_interval_id(const char *uinterval_name, uinterval_type_t type)
+{
+  const uinterval_name_t *found;
+
+  if (type == UI_SCRIPT)
+    found = bsearch(uinterval_name, script_names_sorted, 
+                    NUM_CONSTS(script_names_sorted), 
+                    sizeof(uinterval_name_t), unicode_name_compare);
+  else
+    found = bsearch(uinterval_name, block_names_sorted, 
+                    NUM_CONSTS(block_names_sorted), 
+                    sizeof(uinterval_name_t), unicode_name_compare);
+  return found ? found->id : -1;
+}
 
-  if (fontconfig_pattern_get_charset(pattern, &charset) < 0)
-    return -1.0;
+int unicode_interval_of(uinterval_type_t type, uint32_t ch)
+{
+  if (ch > UNICODE_MAX_CHAR)
+    return -1;
+  return (int)uinterval_table(type, ch) - 1;
+}
+
+/* map entries cut to the 256 codepoint pages FcCharSet */
+/* hands out, so that a page of the font is counted against */
+/* all intervals on it by popcount; entries are [l, u) here */
+typedef struct
+{
+  int id;
+  uint32_t mask[FC_CHARSET_MAP_SIZE];
+} uinterval_fragment_t;
 
-  uinterval_size = charset_success = 0;
+typedef struct
+{
+  int *page_start; /* fragments of page p: page_start[p] */
+                   /* to page_start[p + 1] - 1 */
+  uinterval_fragment_t *fragments;
+  uint32_t *sizes; /* codepoints of every interval */
+} uinterval_pages_t;
+
+#define UNICODE_NPAGES  ((UNICODE_MAX_CHAR + 1) >> 8)
+
+/* built on first use: [0] for UI_SCRIPT, [1] for UI_BLOCK */
+static uinterval_pages_t uinterval_pages[2];
+static int uinterval_pages_ok[2];
+static pthread_once_t uinterval_pages_once[2] = { PTHREAD_ONCE_INIT,
+                                                  PTHREAD_ONCE_INIT };
+
+static int unicode_pages_build(uinterval_type_t uintype, 
+                               uinterval_pages_t *pages)
+{
+  const uinterval_map_t *maps = uinterval_maps(uintype);
+  int m, p, nfragments;
+  uint32_t c, next, first, last;
+  uinterval_fragment_t *f;
+
+  pages->page_start = (int *)calloc(UNICODE_NPAGES + 1, sizeof(int));
+  pages->sizes = (uint32_t *)calloc(uinterval_num(uintype), sizeof(uint32_t));
+  if (! pages->page_start || ! pages->sizes)
+    return -1;
+
+  /* count fragments of every page, then turn counts to starts */
+  for (m = 0; m < uinterval_num_maps(uintype); m++)
+    if (maps[m].l < maps[m].u)
+      for (p = maps[m].l >> 8; p <= (maps[m].u - 1) >> 8; p++)
+        pages->page_start[p + 1]++;
+  for (p = 0; p < UNICODE_NPAGES; p++)
+    pages->page_start[p + 1] += pages->page_start[p];
+
+  nfragments = pages->page_start[UNICODE_NPAGES];
+  pages->fragments 
+    = (uinterval_fragment_t *)calloc(nfragments + 1, 
+                                     sizeof(uinterval_fragment_t));
+  if (! pages->fragments)
+    return -1;
+
+  /* fill them in map order, page_start[p] runs to the end of p */
   for (m = 0; m < uinterval_num_maps(uintype); m++)
   {
-    if (! strcmp(uinname, uinterval_maps(uintype)[m].interval_name))
-      for (c = uinterval_maps(uintype)[m].l;
-           c < uinterval_maps(uintype)[m].u; c++)
+    if (maps[m].l >= maps[m].u)
+      continue;
+    pages->sizes[uinterval_map_ids(uintype)[m]] += maps[m].u - maps[m].l;
+    for (p = maps[m].l >> 8; p <= (maps[m].u - 1) >> 8; p++)
+    {
+      f = &pages->fragments[pages->page_start[p]++];
+      f->id = uinterval_map_ids(uintype)[m];
+      first = maps[m].l > (uint32_t)p << 8 ? maps[m].l : (uint32_t)p << 8;
+      last = maps[m].u < (uint32_t)(p + 1) << 8 ? maps[m].u 
+                                                : (uint32_t)(p + 1) << 8;
+      /* word by word */
+      for (c = first; c < last; c = next)
       {
-        if (FcCharSetHasChar(charset, c) == FcTrue)
-          charset_success++;
-        uinterval_size++;
+        next = (c | 31) + 1 < last ? (c | 31) + 1 : last;
+        f->mask[(c & 0xff) >> 5] |= (next - c == 32 ? ~0U 
+                                      : ((1U << (next - c)) - 1) << (c & 31));
       }
+    }
   }
+
+  /* shift starts back */
+  for (p = UNICODE_NPAGES; p > 0; p--)
+    pages->page_start[p] = pages->page_start[p - 1];
+  pages->page_start[0] = 0;
+  return 0;
+}
+
+static void unicode_script_pages_init(void)
+{
+  uinterval_pages_ok[0] 
+    = unicode_pages_build(UI_SCRIPT, &uinterval_pages[0]) == 0;
+}
+
+static void unicode_block_pages_init(void)
+{
+  uinterval_pages_ok[1] 
+    = unicode_pages_build(UI_BLOCK, &uinterval_pages[1]) == 0;
+}
+
+/* walk pages of the charset once, count its characters in */
+/* every interval to success[id]; sizes[id] are interval sizes */
+static int unicode_interval_successes(FcCharSet *charset,
+                                      uinterval_type_t uintype,
+                                      uint32_t *success,
+                                      const uint32_t **sizes)
+{
+  uinterval_pages_t *pages;
+  const uinterval_fragment_t *f, *end;
+  uint32_t map[FC_CHARSET_MAP_SIZE];
+  uint32_t ucs4, next;
+  int t, k;
+
+  t = uintype == UI_SCRIPT ? 0 : 1;
+  pthread_once(&uinterval_pages_once[t], 
+               t == 0 ? unicode_script_pages_init : unicode_block_pages_init);
+  if (! uinterval_pages_ok[t])
+  {
+    font_specimen_error("unicode: out of memory");
+    return -1;
+  }
+  pages = &uinterval_pages[t];
+
+  memset(success, 0, uinterval_num(uintype)*sizeof(uint32_t));
+  for (ucs4 = FcCharSetFirstPage(charset, map, &next);
+       ucs4 != FC_CHARSET_DONE;
+       ucs4 = FcCharSetNextPage(charset, map, &next))
+  {
+    if (ucs4 > UNICODE_MAX_CHAR)
+      break;
+    f = pages->fragments + pages->page_start[ucs4 >> 8];
+    end = pages->fragments + pages->page_start[(ucs4 >> 8) + 1];
+    for (; f < end; f++)
+      for (k = 0; k < FC_CHARSET_MAP_SIZE; k++)
+        success[f->id] += __builtin_popcount(map[k] & f->mask[k]);
+  }
+
+  *sizes = pages->sizes;
+  return 0;
+}
+
+static double unicode_interval_coverage_id(FcPattern *pattern,
+                                           int id,
+                                           uinterval_type_t uintype,
+                                           uint32_t *ch_success,
+                                           uint32_t *ui_size)
+{
+  uint32_t success[uinterval_num(uintype)];
+  const uint32_t *sizes;
+  uint32_t uinterval_size, charset_success;
+  FcCharSet *charset;
+
+  if (fontconfig_pattern_get_charset(pattern, &charset) < 0)
+    return -1.0;
+  if (unicode_interval_successes(charset, uintype, success, &sizes) < 0)
+    return -1.0;
+
+  /* unknown interval is empty */
+  charset_success = id >= 0 ? success[id] : 0;
+  uinterval_size = id >= 0 ? sizes[id] : 0;
   if (ch_success)
     *ch_success = charset_success;
   if (ui_size)
@@ -130,6 +321,17 @@ double unicode_interval_coverage(FcPattern *pattern,
   return (double)charset_success/(double)uinterval_size*100.0;
 }
 
+double unicode_interval_coverage(FcPattern *pattern,
+                                 const char *uinname,
+                                 uinterval_type_t uintype,
+                                 uint32_t *ch_success,
+                                 uint32_t *ui_size)
+{
+  return unicode_interval_coverage_id(pattern,
+                                      unicode_interval_id(uinname, uintype),
+                                      uintype, ch_success, ui_size);
+}
+
 int unicode_interval_statistics(FcPattern *pattern,
                                 uinterval_stat_t **stats,
                                 uinterval_type_t uintype,
@@ -141,6 +343,8 @@ int unicode_interval_statistics(FcPattern *pattern,
   const int map_len = uinterval_num(uintype);
 
   uinterval_stat_t stat;
+  uint32_t success[map_len];
+  const uint32_t *sizes;
 
   FcCharSet *charset;
 
@@ -155,23 +359,23 @@ int unicode_interval_statistics(FcPattern *pattern,
   if (fontconfig_pattern_get_charset(pattern, &charset) < 0)
     return -1;
 
+  /* all intervals in one pass over the charset */
+  if (unicode_interval_successes(charset, uintype, success, &sizes) < 0)
+    return -1;
+
   /* sort intervals according to coverage values in the font */
   for (s = 0; s < map_len; s++)
   {
     stat.ui_name = uinterval_name(s, uintype);
-    stat.coverage
-       = unicode_interval_coverage(pattern,
-                                   stat.ui_name,
-                                   uintype,
-                                   &stat.success,
-                                   &stat.uinterval_size);
-
-    if (stat.coverage < 0)
-      return -1;
+    stat.success = success[s];
+    stat.uinterval_size = sizes[s];
 
     if (stat.success == 0)
       continue; /* trow stat away */
 
+    stat.coverage 
+      = (double)stat.success/(double)stat.uinterval_size*100.0;
+
     v = 0;
     loop_end = 0;
     while (v < nintervals)
@@ -246,70 +450,108 @@ int unicode_coveres_sentence(FcPattern *pattern,
   return c;
 }
 
+/* bit p of pages is set when charset has some char of page p */
+static void unicode_charset_pages(FcCharSet *charset,
+                                  uint32_t pages[UNICODE_NUM_PAGES/32])
+{
+  FcChar32 ucs4, next;
+  FcChar32 map[FC_CHARSET_MAP_SIZE];
+
+  memset(pages, 0, UNICODE_NUM_PAGES/32*sizeof(uint32_t));
+  for (ucs4 = FcCharSetFirstPage(charset, map, &next);
+       ucs4 != FC_CHARSET_DONE;
+       ucs4 = FcCharSetNextPage(charset, map, &next))
+    if ((ucs4 >> 8) < UNICODE_NUM_PAGES)
+      pages[ucs4 >> 13] |= 1U << ((ucs4 >> 8) & 31);
+}
+
+/* 0 when sentence touches a page charset has nothing from */
+static int unicode_pages_cover(const uint32_t pages[UNICODE_NUM_PAGES/32],
+                               const sentence_ucs4_t *sentence)
+{
+  int p;
+  uint16_t page;
+
+  for (p = 0; p < sentence->npages; p++)
+  {
+    page = sentence_pages[sentence->pages + p];
+    if (! (pages[page >> 5] & (1U << (page & 31))))
+      return 0;
+  }
+  return 1;
+}
+
+int unicode_interval_contains_id(int id,
+                                 uinterval_type_t type,
+                                 uint32_t ch)
+{
+  return id >= 0 && unicode_interval_of(type, ch) == id;
+}
+
 int unicode_interval_contains(const char *uinterval_name,
                               uinterval_type_t type,
                               uint32_t ch)
 {
-  int in;
-  const uinterval_map_t *map = uinterval_maps(type);
-  for (in = 0; in < uinterval_num_maps(type); in++)
-  {
-    if (strcmp(map[in].interval_name, uinterval_name) == 0)
-    {
-      if (map[in].l <= ch && ch <= map[in].u)
-        return 1;
-    }
-    else
-    {
-      if (map[in].l <= ch && ch <= map[in].u)
-        return 0;
-    }
+  return unicode_interval_contains_id(unicode_interval_id(uinterval_name,
+                                                          type),
+                                      type, ch);
+}
 
-  }
-  return 0;
+int unicode_script_id(const char *script)
+{
+  return unicode_interval_id(script, UI_SCRIPT);
 }
 
-int unicode_script_exists(const char *script)
+const char *unicode_script_name(int id)
 {
-  int s;
-  for (s = 0; s < NUMSCRIPTS; s++)
-    if (strcmp(script_consts[s].name, script) == 0)
-      return 1;
+  return 0 <= id && id < NUMSCRIPTS ? script_consts[id].name : NULL;
+}
 
-  return 0;
+/* tag, direction and sentences of the script, NULL for none */
+static const script_data_t *unicode_script_data(int id)
+{
+  if (id < 0 || id >= NUMSCRIPTS || script_data_index[id] < 0)
+    return NULL;
+  return &script_data_consts[script_data_index[id]];
+}
+
+int unicode_script_exists(const char *script)
+{
+  return unicode_script_id(script) >= 0;
 }
 
 void unicode_script_sentences(const char *script,
                               int *nsentences,
-                              sentence_t **sentences,
+                              const sentence_ucs4_t **sentences,
                               text_dir_t *dir,
                               img_transform_t *transform)
 {
-  int sd;
+  const script_data_t *data = unicode_script_data(unicode_script_id(script));
+
   *sentences = NULL;
   *nsentences = 0;
-  for (sd = 0; sd < NUM_CONSTS(script_data_consts); sd++)
-    if (strcmp(script_data_consts[sd].script, script) == 0)
-    {
-      *nsentences = script_data_consts[sd].nsentences;
-      *sentences = script_data_consts[sd].sentences;
-      *dir = script_data_consts[sd].dir;
-      if (transform)
-        *transform = script_data_consts[sd].transform;
-      break;
-    }
+  if (data)
+  {
+    *nsentences = data->nsentences;
+    *sentences = &sentence_ucs4[sentence_first[data - script_data_consts]];
+    *dir = data->dir;
+    if (transform)
+      *transform = data->transform;
+  }
 
   return;
 }
 
-uint32_t unicode_script_tag(const char *script)
+uint32_t unicode_script_tag_id(int id)
 {
-  int s;
-  for (s = 0; s < NUM_CONSTS(script_data_consts); s++)
-    if (strcmp(script_data_consts[s].script, script) == 0)
-      return script_data_consts[s].tag;
+  const script_data_t *data = unicode_script_data(id);
 
-  return 0;
+  return data ? data->tag : 0;
+}
+
+uint32_t unicode_script_tag(const char *script)
+{
+  return unicode_script_tag_id(unicode_script_id(script));
 }
 
 int unicode_specimen_sentence(FcPattern *pattern, 
@@ -325,7 +567,8 @@ int unicode_specimen_sentence(FcPattern *pattern,
   int n;
 
   int s, nsentences;
-  sentence_t *sentences;
+  const sentence_ucs4_t *sentences;
+  uint32_t pages[UNICODE_NUM_PAGES/32];
   int missing; /* first missing character index */
   FcCharSet *charset;
 
@@ -396,7 +639,16 @@ int unicode_specimen_sentence(FcPattern *pattern,
 
   for (s = 0; s < nsentences; s++)
   {
-    n = unicode_utf8toucs4(sentences[s].sent, ucs4str, maxlen - 1);
+    /* usually the first sentence fits; page summary of the charset */
+    /* pays off only for the rest */
+    if (s == 1)
+      unicode_charset_pages(charset, pages);
+    n = sentences[s].len;
+    if (n > maxlen - 1)
+      n = maxlen - 1; /* tail may be on other pages */
+    else if (s > 0 && ! unicode_pages_cover(pages, &sentences[s]))
+      continue;
+    memcpy(ucs4str, &sentence_chars[sentences[s].chars], n*sizeof(uint32_t));
     if ((missing =
           unicode_coveres_sentence(pattern, ucs4str, n,
                                       wanted_script)) == n)
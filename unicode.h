@@ -78,9 +78,24 @@ int unicode_specimen_sentence(FcPattern *pattern,
                               int *random,  
                               uint32_t *ucs4str);
 
+/* interval names are interned: id is the index of the name */
+/* among intervals of the type, -1 for unknown names */
+int unicode_interval_id(const char *uinterval_name, uinterval_type_t type);
+/* id of the interval ch belongs to, -1 for none; where intervals */
+/* overlap, ch belongs to the first one in the map */
+int unicode_interval_of(uinterval_type_t type, uint32_t ch);
+int unicode_interval_contains_id(int id,
+                                 uinterval_type_t type,
+                                 uint32_t ch);
 int unicode_interval_contains(const char *uinterval_name,
                               uinterval_type_t type,
                               uint32_t ch);
 
+/* scripts are the UI_SCRIPT intervals, with the same ids; */
+/* unknown names give -1, unknown ids NULL or 0 */
+int unicode_script_id(const char *script);
+const char *unicode_script_name(int id);
+/* OpenType tag, 0 for scripts without sentences */
+uint32_t unicode_script_tag_id(int id);
 uint32_t unicode_script_tag(const char *script);
 #endif
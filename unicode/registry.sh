@@ -0,0 +1,67 @@
+# registry.sh -- generate interval name registry
+#
+# Copyright (C) 2013 Petr Gajdos (pgajdos at suse)
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# usage: sh registry.sh prefix names.txt [sentences.txt]
+#
+# names.txt gives interval names in id order (first quoted string
+# of every line).  Outputs prefix_names_sorted[], {name, id} in
+# strcmp() order for bsearch(), and with sentences.txt also
+# prefix_data_index[]: for every id the index of its entry in
+# sentences.txt, -1 when it has none.
+
+echo "/* generated by registry.sh, do not edit */"
+echo
+echo "static const uinterval_name_t $1_names_sorted[] ="
+echo "{"
+grep '"' "$2" | sed 's:^[^"]*"\([^"]*\)".*:\1:' \
+  | awk '{ printf("%s\t%d\n", $0, NR - 1) }' \
+  | LC_ALL=C sort -t '	' -k1,1 \
+  | awk -F '	' '{ printf("  {\"%s\", %d},\n", $1, $2) }'
+echo "};"
+
+[ -n "$3" ] || exit 0
+
+echo
+echo "static const int $1_data_index[] ="
+echo "{"
+awk '
+function name(line)
+{
+  sub(/^[^"]*"/, "", line)
+  sub(/".*$/, "", line)
+  return line
+}
+
+FNR == NR {
+  if ($0 ~ /"/)
+    names[nids++] = name($0)
+  next
+}
+
+/^  "/ {
+  if (! (name($0) in data))
+    data[name($0)] = ndata
+  ndata++
+}
+
+END {
+  for (id = 0; id < nids; id++)
+    printf("  %d, /* %s */\n", names[id] in data ? data[names[id]] : -1,
+           names[id])
+}' "$2" "$3"
+echo "};"
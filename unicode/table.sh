@@ -0,0 +1,108 @@
+# table.sh -- generate two-level codepoint to interval id table
+#
+# Copyright (C) 2013 Petr Gajdos (pgajdos at suse)
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# usage: sh table.sh prefix names.txt map.txt
+#
+# names.txt gives interval names in id order (first quoted string
+# of every line), map.txt the {0xL, 0xU, "name"} intervals, bounds
+# included; codepoint belongs to the first interval containing it.
+# Outputs prefix_map_ids[] (id of every map entry) and the table:
+# prefix_pages[cp >> 8] is the block of prefix_ids[] holding
+# id + 1 (0 for no interval) of the 256 codepoints of the page;
+# arrays are of the smallest type their values fit in.
+
+awk -v prefix="$1" '
+function hex(s,    v, i)
+{
+  s = toupper(s)
+  sub(/^0X/, "", s)
+  v = 0
+  for (i = 1; i <= length(s); i++)
+    v = v*16 + index("0123456789ABCDEF", substr(s, i, 1)) - 1
+  return v
+}
+
+function name(line)
+{
+  sub(/^[^"]*"/, "", line)
+  sub(/".*$/, "", line)
+  return line
+}
+
+function type(max)
+{
+  return max < 256 ? "uint8_t" : "uint16_t"
+}
+
+function row(values, n,    i, s)
+{
+  s = ""
+  for (i = 0; i < n; i++)
+    s = s (i % 12 ? " " : (i ? "\n  " : "  ")) values[i] ","
+  return s
+}
+
+FNR == NR {
+  if ($0 ~ /"/)
+    ids[name($0)] = nids++
+  next
+}
+
+$0 ~ /"/ {
+  line = $0
+  gsub(/[{},]/, " ", line)
+  split(line, f, " ")
+  id = ids[name($0)]
+  map_ids[nmap++] = id
+  for (cp = hex(f[1]); cp <= hex(f[2]); cp++)
+    if (! (cp in owner))
+      owner[cp] = id + 1
+}
+
+END {
+  printf("/* generated by table.sh, do not edit */\n\n")
+  printf("static const %s %s_map_ids[] =\n{\n%s\n};\n\n",
+         type(nids), prefix, row(map_ids, nmap))
+
+  npages = 1114112/256
+  nblocks = 0
+  for (page = 0; page < npages; page++)
+  {
+    key = ""
+    for (cp = page*256; cp < page*256 + 256; cp++)
+      key = key " " (cp in owner ? owner[cp] : 0)
+    if (! (key in blocks))
+    {
+      blocks[key] = nblocks
+      block_keys[nblocks++] = key
+    }
+    pages[page] = blocks[key]
+  }
+
+  printf("static const %s %s_pages[] =\n{\n%s\n};\n\n",
+         type(nblocks), prefix, row(pages, npages))
+  printf("static const %s %s_ids[] =\n{\n", type(nids + 1), prefix)
+  for (b = 0; b < nblocks; b++)
+  {
+    split(substr(block_keys[b], 2), values, " ")
+    for (i = 0; i < 256; i++)
+      block[i] = values[i + 1]
+    printf("%s\n", row(block, 256))
+  }
+  printf("};\n")
+}' "$2" "$3"
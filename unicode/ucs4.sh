@@ -0,0 +1,157 @@
+# ucs4.sh -- generate decoded sentences
+#
+# Copyright (C) 2013 Petr Gajdos (pgajdos at suse)
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# usage: sh ucs4.sh sentences.txt
+#
+# Decodes the UTF-8 sentences of sentences.txt at build time.
+# Outputs sentence_chars[], the UCS-4 characters of all sentences,
+# sentence_pages[], the distinct charset pages (cp >> 8) every
+# sentence touches, sentence_ucs4[], {chars offset, length, pages
+# offset, number of pages, language} of every sentence, and
+# sentence_first[], index of the first sentence of every
+# sentences.txt entry.
+
+LC_ALL=C awk '
+BEGIN {
+  for (b = 1; b < 256; b++)
+    ord[sprintf("%c", b)] = b
+  nentries = nsentences = nchars = npagesall = 0
+}
+
+function fail(msg)
+{
+  printf("ucs4.sh: line %d: %s\n", FNR, msg) > "/dev/stderr"
+  failed = 1
+  exit 1
+}
+
+# decode utf8 string s to ucs[1..n], returns n
+function decode(s,    n, i, b, c, more)
+{
+  n = 0
+  for (i = 1; i <= length(s); i++)
+  {
+    b = ord[substr(s, i, 1)]
+    if (b < 128)
+    {
+      c = b; more = 0
+    }
+    else if (b >= 240 && b < 248)
+    {
+      c = b - 240; more = 3
+    }
+    else if (b >= 224)
+    {
+      c = b - 224; more = 2
+    }
+    else if (b >= 192)
+    {
+      c = b - 192; more = 1
+    }
+    else
+      fail("invalid utf-8")
+    for (; more > 0; more--)
+    {
+      b = ord[substr(s, ++i, 1)]
+      if (b < 128 || b >= 192)
+        fail("invalid utf-8")
+      c = c*64 + b - 128
+    }
+    ucs[++n] = c
+  }
+  return n
+}
+
+/^  "/ {
+  name = $0
+  sub(/^  "/, "", name)
+  sub(/".*$/, "", name)
+  first[nentries] = nsentences
+  names[nentries++] = name
+  next
+}
+
+/^ *{"/ {
+  text = $0
+  sub(/^ *{"/, "", text)
+  sub(/".*$/, "", text)
+  n = decode(text)
+  lang = $0
+  sub(/^ *{"[^"]*"[^"]*"/, "", lang)
+  sub(/".*$/, "", lang)
+
+  line = ""
+  npages = 0
+  split("", seen)
+  for (i = 1; i <= n; i++)
+  {
+    line = line (i > 1 ? " " : "") sprintf("0x%x,", ucs[i])
+    page = int(ucs[i]/256)
+    if (! (page in seen))
+    {
+      seen[page] = 1
+      pages[npagesall + npages++] = page
+    }
+  }
+  chars[nsentences] = line
+  entry[nsentences] = name
+  langs[nsentences] = lang
+  offset[nsentences] = nchars
+  length_[nsentences] = n
+  pages_offset[nsentences] = npagesall
+  pages_num[nsentences++] = npages
+  nchars += n
+  npagesall += npages
+}
+
+END {
+  if (failed)
+    exit 1
+
+  print "/* generated by ucs4.sh, do not edit */"
+  print ""
+  print "static const uint32_t sentence_chars[] ="
+  print "{"
+  for (s = 0; s < nsentences; s++)
+    printf("  /* %s */\n  %s\n", entry[s], chars[s])
+  print "};"
+  print ""
+  print "static const uint16_t sentence_pages[] ="
+  print "{"
+  for (s = 0; s < nsentences; s++)
+  {
+    printf(" ")
+    for (p = 0; p < pages_num[s]; p++)
+      printf(" 0x%x,", pages[pages_offset[s] + p])
+    printf(" /* %s */\n", entry[s])
+  }
+  print "};"
+  print ""
+  print "static const sentence_ucs4_t sentence_ucs4[] ="
+  print "{"
+  for (s = 0; s < nsentences; s++)
+    printf("  {%d, %d, %d, %d, \"%s\"}, /* %s */\n", offset[s], length_[s],
+           pages_offset[s], pages_num[s], langs[s], entry[s])
+  print "};"
+  print ""
+  print "static const int sentence_first[] ="
+  print "{"
+  for (e = 0; e < nentries; e++)
+    printf("  %d, /* %s */\n", first[e], names[e])
+  print "};"
+}' "$1"